@@ -0,0 +1,555 @@
+/**
+ * @file async_io.hpp
+ * @brief Asynchronous reads and writes of whole files.
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_ASYNC_IO_HPP
+#define MI_ASYNC_IO_HPP 1
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "page_cache.hpp"
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MI_ASYNC_IO_URING 1
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mi {
+        /**
+         * @brief Reads and writes of whole files submitted without waiting for them.
+         * @note Requests are grouped by batches, and each batch waits for its own requests. Up to depth requests are in flight at once,
+         * and submission blocks beyond that, so that buffers of pending writes do not pile up.
+         * On Linux, requests are queued to io_uring and completed by a single thread.
+         * If io_uring is not available (e.g., old kernels, containers forbidding it, other platforms), requests are run by up to 16 I/O threads.
+         * If the ring fails while it is used, the requests in flight fail and the later ones are run by the I/O threads.
+         * The cache policy is applied on Linux. Files read are dropped from the page cache, and the writeback of files written is started at once.
+         * With O_DIRECT, buffers are staged in aligned memory and files written are padded to the alignment and truncated afterwards.
+         * Files on file systems refusing O_DIRECT (e.g., tmpfs) are written back and dropped as with drop.
+         */
+        class async_io {
+        private:
+                static constexpr size_t alignment = 4096; ///< alignment of O_DIRECT transfers (the largest logical block size in common use)
+
+                struct aligned_delete {
+                        void operator()(uint8_t *p) const {
+                                ::operator delete[](p, std::align_val_t(async_io::alignment));
+                        }
+                };
+
+                struct batch_state {
+                        std::mutex mtx;
+                        std::condition_variable cv;
+                        size_t pending = 0;
+                        std::string error; ///< the first error
+                };
+
+                struct request {
+                        std::filesystem::path path;
+                        bool is_write = false;
+                        uint8_t *data = nullptr; ///< the buffer transferred
+                        size_t bytes = 0; ///< bytes transferred (rounded up to the alignment with O_DIRECT)
+                        size_t size = 0; ///< bytes of the file
+                        size_t done = 0; ///< bytes transferred so far
+                        std::vector<uint8_t> buffer; ///< data of a write
+                        std::unique_ptr<uint8_t[], aligned_delete> aligned; ///< the buffer of O_DIRECT
+                        uint8_t *target = nullptr; ///< destination of a read through the aligned buffer
+                        std::shared_ptr<batch_state> batch;
+                        int fd = -1;
+                        bool is_direct = false; ///< the file was opened with O_DIRECT
+
+                        /// a read is done at the end of the file even if the aligned buffer is not filled.
+                        [[nodiscard]] bool is_done() const {
+                                return this->done >= (this->is_write ? this->bytes : this->size);
+                        }
+                };
+
+                cache_policy cache_;
+                size_t depth_;
+                size_t in_flight_;
+                std::atomic<uint64_t> files_{0}; ///< files written
+                bool is_stopped_;
+                std::mutex mtx_;
+                std::condition_variable cv_;
+                std::deque<std::unique_ptr<request>> queue_; ///< requests of the I/O threads
+                std::vector<std::thread> threads_;
+#if defined(MI_ASYNC_IO_URING)
+                int ring_fd_ = -1;
+                void *sq_ptr_ = nullptr; ///< the SQ and CQ rings (a single mapping)
+                size_t sq_bytes_ = 0, sqes_bytes_ = 0;
+                io_uring_sqe *sqes_ = nullptr;
+                uint32_t *sq_head_ = nullptr, *sq_tail_ = nullptr, *sq_mask_ = nullptr, *sq_array_ = nullptr;
+                uint32_t *cq_head_ = nullptr, *cq_tail_ = nullptr, *cq_mask_ = nullptr;
+                io_uring_cqe *cqes_ = nullptr;
+                std::mutex sq_mtx_;
+                std::unordered_set<request *> ring_requests_; ///< requests queued to the ring (guarded by sq_mtx_)
+                std::atomic<bool> is_broken_{false}; ///< the ring is not used any more
+
+                int enter(const unsigned int to_submit, const unsigned int min_complete, const unsigned int flags) {
+                        return int(::syscall(__NR_io_uring_enter, this->ring_fd_, to_submit, min_complete, flags, nullptr, 0));
+                }
+
+                bool setup_ring() {
+                        io_uring_params p;
+                        std::memset(&p, 0, sizeof(p));
+                        this->ring_fd_ = int(::syscall(__NR_io_uring_setup, unsigned(this->depth_), &p));
+                        if (this->ring_fd_ < 0) {
+                                return false;
+                        }
+                        // IORING_OP_READ and IORING_OP_WRITE came with IORING_FEAT_RW_CUR_POS (Linux 5.6).
+                        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+                                this->close_ring();
+                                return false;
+                        }
+                        this->sq_bytes_ = std::max(p.sq_off.array + p.sq_entries * sizeof(uint32_t), p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+                        this->sq_ptr_ = ::mmap(nullptr, this->sq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQ_RING);
+                        this->sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+                        void *sqes = ::mmap(nullptr, this->sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQES);
+                        if (this->sq_ptr_ == MAP_FAILED || sqes == MAP_FAILED) {
+                                this->sq_ptr_ = (this->sq_ptr_ == MAP_FAILED) ? nullptr : this->sq_ptr_;
+                                this->sqes_ = (sqes == MAP_FAILED) ? nullptr : static_cast<io_uring_sqe *>(sqes);
+                                this->close_ring();
+                                return false;
+                        }
+                        auto *sq = static_cast<uint8_t *>(this->sq_ptr_);
+                        this->sqes_ = static_cast<io_uring_sqe *>(sqes);
+                        this->sq_head_ = reinterpret_cast<uint32_t *>(sq + p.sq_off.head);
+                        this->sq_tail_ = reinterpret_cast<uint32_t *>(sq + p.sq_off.tail);
+                        this->sq_mask_ = reinterpret_cast<uint32_t *>(sq + p.sq_off.ring_mask);
+                        this->sq_array_ = reinterpret_cast<uint32_t *>(sq + p.sq_off.array);
+                        this->cq_head_ = reinterpret_cast<uint32_t *>(sq + p.cq_off.head);
+                        this->cq_tail_ = reinterpret_cast<uint32_t *>(sq + p.cq_off.tail);
+                        this->cq_mask_ = reinterpret_cast<uint32_t *>(sq + p.cq_off.ring_mask);
+                        this->cqes_ = reinterpret_cast<io_uring_cqe *>(sq + p.cq_off.cqes);
+                        return true;
+                }
+
+                void close_ring() {
+                        if (this->sqes_ != nullptr) {
+                                ::munmap(this->sqes_, this->sqes_bytes_);
+                        }
+                        if (this->sq_ptr_ != nullptr) {
+                                ::munmap(this->sq_ptr_, this->sq_bytes_);
+                        }
+                        if (this->ring_fd_ >= 0) {
+                                ::close(this->ring_fd_);
+                        }
+                        this->ring_fd_ = -1;
+                        this->sq_ptr_ = nullptr;
+                        this->sqes_ = nullptr;
+                }
+
+                // queue the rest of the request (r == nullptr : a no-op waking the completion thread).
+                // @return 0, or the error if the request was not queued. The request is not completed then.
+                [[nodiscard]] int submit_ring(request *r) {
+                        std::lock_guard<std::mutex> lock(this->sq_mtx_);
+                        if (this->is_broken_) {
+                                return EIO;
+                        }
+                        const uint32_t tail = std::atomic_ref<uint32_t>(*this->sq_tail_).load(std::memory_order_acquire);
+                        const uint32_t index = tail & *this->sq_mask_;
+                        io_uring_sqe &sqe = this->sqes_[index];
+                        std::memset(&sqe, 0, sizeof(sqe));
+                        if (r == nullptr) {
+                                sqe.opcode = IORING_OP_NOP;
+                        } else {
+                                sqe.opcode = r->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+                                sqe.fd = r->fd;
+                                sqe.addr = reinterpret_cast<uint64_t>(r->data + r->done);
+                                sqe.len = uint32_t(std::min<size_t>(r->bytes - r->done, size_t(1) << 30));
+                                sqe.off = r->done;
+                        }
+                        sqe.user_data = reinterpret_cast<uint64_t>(r);
+                        this->sq_array_[index] = index;
+                        std::atomic_ref<uint32_t>(*this->sq_tail_).store(tail + 1, std::memory_order_release);
+                        int result;
+                        while ((result = this->enter(1, 0, 0)) < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+                                std::this_thread::yield();
+                        }
+                        // the entry is consumed only by enter() under the lock, so that an entry left in the ring is taken back.
+                        if (result < 0 && std::atomic_ref<uint32_t>(*this->sq_head_).load(std::memory_order_acquire) != tail + 1) {
+                                const int error = errno;
+                                std::atomic_ref<uint32_t>(*this->sq_tail_).store(tail, std::memory_order_release);
+                                return error;
+                        }
+                        if (r != nullptr) {
+                                this->ring_requests_.insert(r);
+                        }
+                        return 0;
+                }
+
+                // fail the requests in the ring. The later requests are run by the I/O threads.
+                void break_ring(const std::string &error) {
+                        std::vector<request *> requests;
+                        {
+                                std::lock_guard<std::mutex> lock(this->sq_mtx_);
+                                this->is_broken_ = true;
+                                requests.assign(this->ring_requests_.begin(), this->ring_requests_.end());
+                                this->ring_requests_.clear();
+                        }
+                        {
+                                std::lock_guard<std::mutex> lock(this->mtx_);
+                                for (size_t i = 0; !this->is_stopped_ && i < std::min<size_t>(this->depth_, 16); ++i) {
+                                        this->threads_.emplace_back(&async_io::work, this);
+                                }
+                        }
+                        for (auto *r: requests) {
+                                this->finish(r, error.c_str());
+                        }
+                }
+
+                // complete the request of the entry.
+                void complete(request *r, const int res) {
+                        {
+                                std::lock_guard<std::mutex> lock(this->sq_mtx_);
+                                this->ring_requests_.erase(r);
+                        }
+                        if (res <= 0) { // failure or the end of a short file
+                                this->finish(r, (res < 0) ? std::strerror(-res) : "unexpected end of file");
+                        } else if (r->done += size_t(res); r->is_done()) {
+                                this->finish(r, nullptr);
+                        } else if (const int error = this->submit_ring(r); error != 0) { // partial transfer
+                                this->finish(r, std::strerror(error));
+                        }
+                }
+
+                void complete_ring() {
+                        for (;;) {
+                                if (this->enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                                        this->break_ring(std::string("io_uring : ") + std::strerror(errno));
+                                        return;
+                                }
+                                uint32_t head = std::atomic_ref<uint32_t>(*this->cq_head_).load(std::memory_order_acquire);
+                                const uint32_t tail = std::atomic_ref<uint32_t>(*this->cq_tail_).load(std::memory_order_acquire);
+                                {
+                                        // the requests completed were queued under the lock, so that taking it orders their fields before the reads below.
+                                        std::lock_guard<std::mutex> lock(this->sq_mtx_);
+                                }
+                                bool is_stopped = false;
+                                for (; head != tail; ++head) {
+                                        const io_uring_cqe &cqe = this->cqes_[head & *this->cq_mask_];
+                                        auto *r = reinterpret_cast<request *>(cqe.user_data);
+                                        if (r == nullptr) {
+                                                is_stopped = true;
+                                                continue;
+                                        }
+                                        this->complete(r, cqe.res);
+                                }
+                                std::atomic_ref<uint32_t>(*this->cq_head_).store(head, std::memory_order_release);
+                                if (is_stopped) {
+                                        return;
+                                }
+                        }
+                }
+#endif
+
+#if defined(MI_ASYNC_IO_URING)
+                // open the file of the request. O_DIRECT is dropped on file systems not supporting it (e.g., tmpfs).
+                [[nodiscard]] int open(request &r) const {
+                        const int flags = r.is_write ? (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC) : (O_RDONLY | O_CLOEXEC);
+                        if (this->cache_ == cache_policy::direct) {
+                                if (const int fd = ::open(r.path.c_str(), flags | O_DIRECT, 0644); fd >= 0 || errno != EINVAL) {
+                                        r.is_direct = (fd >= 0);
+                                        return fd;
+                                }
+                        }
+                        return ::open(r.path.c_str(), flags, 0644);
+                }
+#endif
+
+                // blocking transfer of the I/O threads.
+                void transfer(request &r) const {
+#if defined(MI_ASYNC_IO_URING)
+                        if ((r.fd = this->open(r)) < 0) {
+                                throw std::runtime_error(std::strerror(errno));
+                        }
+                        while (!r.is_done()) {
+                                const ssize_t n = r.is_write ? ::pwrite(r.fd, r.data + r.done, r.bytes - r.done, off_t(r.done)) : ::pread(r.fd, r.data + r.done, r.bytes - r.done, off_t(r.done));
+                                if (n < 0 && errno == EINTR) {
+                                        continue;
+                                } else if (n <= 0) {
+                                        throw std::runtime_error(n < 0 ? std::strerror(errno) : "unexpected end of file");
+                                }
+                                r.done += size_t(n);
+                        }
+#else
+                        if (r.is_write) {
+                                std::ofstream fout(r.path, std::ios::binary);
+                                fout.write(reinterpret_cast<const char *>(r.data), std::streamsize(r.bytes));
+                                if (!fout) {
+                                        throw std::runtime_error("cannot be written");
+                                }
+                        } else {
+                                std::ifstream fin(r.path, std::ios::binary);
+                                fin.read(reinterpret_cast<char *>(r.data), std::streamsize(r.bytes));
+                                if (!fin) {
+                                        throw std::runtime_error("cannot be read");
+                                }
+                        }
+#endif
+                }
+
+                void work() {
+                        for (;;) {
+                                std::unique_ptr<request> r;
+                                {
+                                        std::unique_lock<std::mutex> lock(this->mtx_);
+                                        this->cv_.wait(lock, [this]() { return this->is_stopped_ || !this->queue_.empty(); });
+                                        if (this->queue_.empty()) {
+                                                return;
+                                        }
+                                        r = std::move(this->queue_.front());
+                                        this->queue_.pop_front();
+                                }
+                                try {
+                                        this->transfer(*r);
+                                        this->finish(r.release(), nullptr);
+                                } catch (std::exception &e) {
+                                        this->finish(r.release(), e.what());
+                                }
+                        }
+                }
+
+                // complete the request and release a slot.
+                void finish(request *r, const char *error) {
+                        std::unique_ptr<request> owner(r);
+#if defined(MI_ASYNC_IO_URING)
+                        if (r->fd >= 0) {
+                                if (error == nullptr && r->is_write && r->bytes != r->size && ::ftruncate(r->fd, off_t(r->size)) != 0) { // the padding of O_DIRECT
+                                        error = std::strerror(errno);
+                                }
+                                // files opened without O_DIRECT under the direct policy go through the cache as well.
+                                if (this->cache_ == cache_policy::drop || (this->cache_ == cache_policy::direct && !r->is_direct)) {
+                                        if (r->is_write) {
+                                                mi::write_back(r->fd); // dropped when the file is read
+                                        } else {
+                                                mi::drop_cache(r->fd);
+                                        }
+                                }
+                                ::close(r->fd);
+                        }
+#endif
+                        if (error == nullptr && r->target != nullptr) {
+                                std::memcpy(r->target, r->data, r->size);
+                        }
+                        if (error == nullptr && r->is_write) {
+                                ++this->files_;
+                        }
+                        {
+                                std::lock_guard<std::mutex> lock(r->batch->mtx);
+                                if (error != nullptr && r->batch->error.empty()) {
+                                        r->batch->error = r->path.string() + " : " + error;
+                                }
+                                --r->batch->pending;
+                        }
+                        r->batch->cv.notify_all();
+                        {
+                                std::lock_guard<std::mutex> lock(this->mtx_);
+                                --this->in_flight_;
+                        }
+                        this->cv_.notify_all();
+                }
+
+                [[nodiscard]] static size_t aligned_size(const size_t bytes) {
+                        return (bytes + async_io::alignment - 1) / async_io::alignment * async_io::alignment;
+                }
+
+                [[nodiscard]] static std::unique_ptr<uint8_t[], aligned_delete> allocate(const size_t bytes) {
+                        return std::unique_ptr<uint8_t[], aligned_delete>(static_cast<uint8_t *>(::operator new[](std::max<size_t>(bytes, 1), std::align_val_t(async_io::alignment))));
+                }
+
+                void submit(std::unique_ptr<request> r) {
+                        {
+                                std::lock_guard<std::mutex> lock(r->batch->mtx);
+                                ++r->batch->pending;
+                        }
+                        {
+                                std::unique_lock<std::mutex> lock(this->mtx_);
+                                this->cv_.wait(lock, [this]() { return this->in_flight_ < this->depth_; });
+                                ++this->in_flight_;
+                                if (!this->is_ring()) { // including a broken ring
+                                        this->queue_.push_back(std::move(r));
+                                }
+                        }
+                        if (!r) { // queued to the I/O threads
+                                this->cv_.notify_all();
+                                return;
+                        }
+#if defined(MI_ASYNC_IO_URING)
+                        r->fd = this->open(*r);
+                        if (r->fd < 0) {
+                                this->finish(r.release(), std::strerror(errno));
+                        } else if (r->bytes == 0) {
+                                this->finish(r.release(), nullptr);
+                        } else if (const int error = this->submit_ring(r.get()); error != 0) {
+                                this->finish(r.release(), std::strerror(error));
+                        } else {
+                                r.release(); // owned by the ring
+                        }
+#endif
+                }
+
+        public:
+                /**
+                 * @brief A group of requests waited together.
+                 * @note Requests can be added from multiple threads. The destructor waits for the requests without throwing.
+                 */
+                class batch {
+                private:
+                        async_io &io_;
+                        std::shared_ptr<batch_state> state_;
+                public:
+                        explicit batch(async_io &io) : io_(io), state_(std::make_shared<batch_state>()) {}
+
+                        batch(const batch &that) = delete;
+
+                        batch &operator=(const batch &that) = delete;
+
+                        ~batch() {
+                                std::unique_lock<std::mutex> lock(this->state_->mtx);
+                                this->state_->cv.wait(lock, [this]() { return this->state_->pending == 0; });
+                        }
+
+                        /**
+                         * @brief Write the data to the file (created or truncated).
+                         */
+                        void write(const std::filesystem::path &path, std::vector<uint8_t> data) {
+                                auto r = std::make_unique<request>();
+                                r->path = path;
+                                r->is_write = true;
+                                r->size = data.size();
+                                if (this->io_.cache_ == cache_policy::direct) {
+                                        r->bytes = async_io::aligned_size(r->size);
+                                        r->aligned = async_io::allocate(r->bytes);
+                                        std::memcpy(r->aligned.get(), data.data(), r->size);
+                                        std::memset(r->aligned.get() + r->size, 0, r->bytes - r->size);
+                                        r->data = r->aligned.get();
+                                } else {
+                                        r->buffer = std::move(data);
+                                        r->data = r->buffer.data();
+                                        r->bytes = r->size;
+                                }
+                                r->batch = this->state_;
+                                this->io_.submit(std::move(r));
+                        }
+
+                        /**
+                         * @brief Read the first bytes of the file into data, which must be valid until wait().
+                         */
+                        void read(const std::filesystem::path &path, void *data, const size_t bytes) {
+                                auto r = std::make_unique<request>();
+                                r->path = path;
+                                r->size = bytes;
+                                if (this->io_.cache_ == cache_policy::direct) {
+                                        r->bytes = async_io::aligned_size(bytes);
+                                        r->aligned = async_io::allocate(r->bytes);
+                                        r->data = r->aligned.get();
+                                        r->target = static_cast<uint8_t *>(data);
+                                } else {
+                                        r->data = static_cast<uint8_t *>(data);
+                                        r->bytes = bytes;
+                                }
+                                r->batch = this->state_;
+                                this->io_.submit(std::move(r));
+                        }
+
+                        /**
+                         * @brief Wait for the requests. The batch can be used again.
+                         * @throw runtime_error if a request failed.
+                         */
+                        void wait() {
+                                std::unique_lock<std::mutex> lock(this->state_->mtx);
+                                this->state_->cv.wait(lock, [this]() { return this->state_->pending == 0; });
+                                if (!this->state_->error.empty()) {
+                                        const std::string error = std::move(this->state_->error);
+                                        this->state_->error.clear();
+                                        throw std::runtime_error(error);
+                                }
+                        }
+                };
+
+                /**
+                 * @param depth The maximum number of requests in flight.
+                 * @param cache Use of the page cache by the files (Linux only).
+                 * @param is_uring_used Use io_uring if it is available.
+                 */
+                explicit async_io(const size_t depth = 64, const cache_policy cache = cache_policy::keep, [[maybe_unused]] const bool is_uring_used = true)
+                        : cache_(cache), depth_(std::max<size_t>(depth, 1)), in_flight_(0), is_stopped_(false) {
+#if !defined(MI_ASYNC_IO_URING)
+                        this->cache_ = cache_policy::keep;
+#endif
+#if defined(MI_ASYNC_IO_URING)
+                        if (is_uring_used && this->setup_ring()) {
+                                this->threads_.emplace_back(&async_io::complete_ring, this);
+                                return;
+                        }
+#endif
+                        for (size_t i = 0; i < std::min<size_t>(this->depth_, 16); ++i) {
+                                this->threads_.emplace_back(&async_io::work, this);
+                        }
+                }
+
+                async_io(const async_io &that) = delete;
+
+                async_io &operator=(const async_io &that) = delete;
+
+                ~async_io() {
+                        {
+                                std::unique_lock<std::mutex> lock(this->mtx_);
+                                this->cv_.wait(lock, [this]() { return this->in_flight_ == 0; });
+                                this->is_stopped_ = true;
+                        }
+                        this->cv_.notify_all();
+#if defined(MI_ASYNC_IO_URING)
+                        if (this->is_ring() && this->submit_ring(nullptr) != 0) {
+                                this->break_ring("io_uring : stopped"); // no request is left. The completion thread returns when its wait fails too.
+                        }
+#endif
+                        std::for_each(this->threads_.begin(), this->threads_.end(), [](auto &t) { t.join(); });
+#if defined(MI_ASYNC_IO_URING)
+                        this->close_ring();
+#endif
+                }
+
+                [[nodiscard]] bool is_ring() const {
+#if defined(MI_ASYNC_IO_URING)
+                        return this->ring_fd_ >= 0 && !this->is_broken_;
+#else
+                        return false;
+#endif
+                }
+
+                /// the number of files written successfully.
+                [[nodiscard]] uint64_t files_written() const {
+                        return this->files_;
+                }
+
+                /// io_uring or threads
+                [[nodiscard]] std::string backend() const {
+                        return this->is_ring() ? "io_uring" : "threads";
+                }
+        };
+}
+#endif //MI_ASYNC_IO_HPP
@@ -0,0 +1,61 @@
+/**
+ * @file available_memory_size.hpp
+ * @brief
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_AVAILABLE_MEMORY_SIZE_HPP
+#define MI_AVAILABLE_MEMORY_SIZE_HPP 1
+#include <cstddef>
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min and std::max usable
+#endif
+#include <windows.h>
+#elif defined (__APPLE__)
+#include <mach/mach.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <limits>
+#include <string>
+#include <unistd.h>
+#endif
+namespace mi {
+        /**
+         * @brief Return the size of physical memory which can be used without swapping in bytes.
+         * @return Available memory size. 0 if it cannot be obtained.
+         */
+        inline size_t available_memory_size() {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+                MEMORYSTATUSEX status;
+                status.dwLength = sizeof(status);
+                if (GlobalMemoryStatusEx(&status)) {
+                        return size_t(status.ullAvailPhys);
+                } else {
+                        return 0;
+                }
+#elif defined (__APPLE__)
+                vm_statistics64_data_t stat;
+                mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+                if (host_statistics64(mach_host_self(), HOST_VM_INFO64, reinterpret_cast<host_info64_t>(&stat), &count) == KERN_SUCCESS) {
+                        return size_t(stat.free_count + stat.inactive_count) * size_t(sysconf(_SC_PAGESIZE));
+                } else {
+                        return 0;
+                }
+#else
+                // MemAvailable includes reclaimable page cache unlike _SC_AVPHYS_PAGES.
+                std::ifstream fin("/proc/meminfo");
+                for (std::string key; fin >> key;) {
+                        if (size_t kb; key == "MemAvailable:" && fin >> kb) {
+                                return kb * 1024;
+                        }
+                        fin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                }
+                return size_t(sysconf(_SC_AVPHYS_PAGES)) * size_t(sysconf(_SC_PAGESIZE));
+#endif
+        }// available_memory_size
+} //namespace
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file box_filter.hpp
+ * @brief Box filters for downsampling images.
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_BOX_FILTER_HPP
+#define MI_BOX_FILTER_HPP 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mi {
+        /**
+         * @brief Sums of 2x2 blocks of an image with interleaved channels.
+         * @param src The first row of the image. Rows are src_step bytes apart.
+         * @param dst The sums of (width + 1) / 2 x (height + 1) / 2 pixels. Rows are dst_step elements apart.
+         * @note The last row and column are repeated when the size is odd, so that every sum has four samples.
+         * Pairs of rows are summed first, so that both loops run over contiguous memory and are vectorized by the compiler.
+         */
+        template<typename T>
+        inline void box_sum_2x2(const uint8_t *src, const size_t src_step, const int width, const int height, const int channels, int32_t *dst, const size_t dst_step) {
+                const size_t n = size_t(width) * channels;
+                const size_t half = size_t(width / 2) * channels;
+                std::vector<int32_t> rows(n);
+                for (int y = 0; y < (height + 1) / 2; ++y) {
+                        const T *__restrict r0 = reinterpret_cast<const T *>(src + src_step * size_t(2 * y));
+                        const T *__restrict r1 = reinterpret_cast<const T *>(src + src_step * size_t(std::min(2 * y + 1, height - 1)));
+                        int32_t *__restrict r = rows.data();
+                        for (size_t i = 0; i < n; ++i) {
+                                r[i] = int32_t(r0[i]) + int32_t(r1[i]);
+                        }
+                        int32_t *__restrict d = dst + dst_step * size_t(y);
+                        if (channels == 1) {
+                                for (size_t i = 0; i < half; ++i) {
+                                        d[i] = r[2 * i] + r[2 * i + 1];
+                                }
+                        } else {
+                                for (size_t i = 0; i < half; i += size_t(channels)) {
+                                        for (size_t c = 0; c < size_t(channels); ++c) {
+                                                d[i + c] = r[2 * i + c] + r[2 * i + channels + c];
+                                        }
+                                }
+                        }
+                        if (width % 2 == 1) {
+                                for (size_t c = 0; c < size_t(channels); ++c) {
+                                        d[half + c] = 2 * r[n - channels + c];
+                                }
+                        }
+                }
+        }
+}
+#endif //MI_BOX_FILTER_HPP
@@ -0,0 +1,36 @@
+/**
+ * @file json_string.hpp
+ * @brief String literal of JSON.
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_JSON_STRING_HPP
+#define MI_JSON_STRING_HPP 1
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace mi {
+        /**
+         * @brief Quote the string and escape it for JSON. Control characters are written as \u00XX.
+         */
+        inline std::string json_string(const std::string &str) {
+                std::stringstream ss;
+                ss << '"';
+                for (const char c: str) {
+                        if (c == '"' || c == '\\') {
+                                ss << '\\' << c;
+                        } else if (static_cast<unsigned char>(c) < 0x20) {
+                                ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+                        } else {
+                                ss << c;
+                        }
+                }
+                ss << '"';
+                return ss.str();
+        }
+}
+#endif //MI_JSON_STRING_HPP
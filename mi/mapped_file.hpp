@@ -0,0 +1,201 @@
+/**
+ * @file mapped_file.hpp
+ * @brief
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_MAPPED_FILE_HPP
+#define MI_MAPPED_FILE_HPP 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "page_cache.hpp"
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mi {
+        /**
+         * @brief File mapped on the memory.
+         */
+        class mapped_file {
+        private:
+                uint8_t *data_;
+                size_t size_;
+                bool is_writable_;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+                HANDLE file_;
+                HANDLE mapping_;
+#else
+                int fd_;
+#endif
+        public:
+                /**
+                 * @brief Map the file.
+                 * @param path File name.
+                 * @param size File size. The file is created (or resized) when size > 0, otherwise an existing file is mapped as read only.
+                 * @throw runtime_error if the file cannot be mapped.
+                 */
+                explicit mapped_file(const std::filesystem::path &path, const size_t size = 0) : data_(nullptr), size_(size), is_writable_(size > 0) {
+                        const bool is_writable = this->is_writable_;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+                        this->mapping_ = nullptr;
+                        this->file_ = CreateFileW(path.wstring().c_str(), GENERIC_READ | (is_writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr, is_writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                        if (this->file_ == INVALID_HANDLE_VALUE) {
+                                throw std::runtime_error(path.string() + " cannot be opened.");
+                        }
+                        LARGE_INTEGER file_size;
+                        if (is_writable) {
+                                file_size.QuadPart = LONGLONG(size);
+                                if (!SetFilePointerEx(this->file_, file_size, nullptr, FILE_BEGIN) || !SetEndOfFile(this->file_)) {
+                                        CloseHandle(this->file_);
+                                        throw std::runtime_error(path.string() + " cannot be allocated.");
+                                }
+                        } else if (GetFileSizeEx(this->file_, &file_size)) {
+                                this->size_ = size_t(file_size.QuadPart);
+                        }
+                        if (this->size_ > 0) {
+                                this->mapping_ = CreateFileMappingW(this->file_, nullptr, is_writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+                                if (this->mapping_ != nullptr) {
+                                        this->data_ = static_cast<uint8_t *>(MapViewOfFile(this->mapping_, is_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+                                }
+                                if (this->data_ == nullptr) {
+                                        this->close();
+                                        throw std::runtime_error(path.string() + " cannot be mapped.");
+                                }
+                        }
+#else
+                        this->fd_ = ::open(path.c_str(), is_writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+                        if (this->fd_ < 0) {
+                                throw std::runtime_error(path.string() + " cannot be opened.");
+                        }
+                        if (is_writable) {
+#if defined(__linux__)
+                                // allocate blocks in advance so that ENOSPC is reported here instead of SIGBUS.
+                                // fallocate() fails on unsupported file systems rather than writing zeros as posix_fallocate() does.
+                                const bool is_allocated = (fallocate(this->fd_, 0, 0, off_t(size)) == 0) || (ftruncate(this->fd_, off_t(size)) == 0);
+#else
+                                const bool is_allocated = (ftruncate(this->fd_, off_t(size)) == 0);
+#endif
+                                if (!is_allocated) {
+                                        ::close(this->fd_);
+                                        throw std::runtime_error(path.string() + " cannot be allocated.");
+                                }
+                        } else if (struct stat st{}; fstat(this->fd_, &st) == 0) {
+                                this->size_ = size_t(st.st_size);
+                        }
+                        if (this->size_ > 0) {
+                                void *ptr = mmap(nullptr, this->size_, PROT_READ | (is_writable ? PROT_WRITE : 0), MAP_SHARED, this->fd_, 0);
+                                if (ptr == MAP_FAILED) {
+                                        ::close(this->fd_);
+                                        throw std::runtime_error(path.string() + " cannot be mapped.");
+                                }
+                                this->data_ = static_cast<uint8_t *>(ptr);
+                        }
+#endif
+                }
+
+                mapped_file(const mapped_file &that) = delete;
+
+                mapped_file(mapped_file &&that) = delete;
+
+                mapped_file &operator=(const mapped_file &that) = delete;
+
+                mapped_file &operator=(mapped_file &&that) = delete;
+
+                ~mapped_file() {
+                        this->close();
+                }
+
+                [[nodiscard]] uint8_t *data() const {
+                        return this->data_;
+                }
+
+                [[nodiscard]] size_t size() const {
+                        return this->size_;
+                }
+
+                /**
+                 * @brief Hint that the range [p, p + bytes) of the mapping is read soon.
+                 */
+                void will_need([[maybe_unused]] const uint8_t *p, [[maybe_unused]] const size_t bytes) const {
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+                        if (auto [offset, length] = this->pages(p, bytes); length > 0) {
+                                ::madvise(this->data_ + offset, length, MADV_WILLNEED);
+                        }
+#endif
+                }
+
+                /**
+                 * @brief Drop the range [p, p + bytes) of the mapping from the page cache. The data is read from the file again if it is accessed.
+                 * @note Dirty pages of a writable mapping are written back first.
+                 */
+                void drop([[maybe_unused]] const uint8_t *p, [[maybe_unused]] const size_t bytes) const {
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+                        if (auto [offset, length] = this->pages(p, bytes); length > 0) {
+                                ::madvise(this->data_ + offset, length, MADV_DONTNEED); // the pages are unmapped, so that the kernel can drop them
+                                mi::drop_cache(this->fd_, offset, length, this->is_writable_);
+                        }
+#endif
+                }
+
+                /**
+                 * @brief Start writing the dirty pages back without waiting for them.
+                 */
+                void write_back() const {
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+                        if (this->is_writable_) {
+                                mi::write_back(this->fd_);
+                        }
+#endif
+                }
+
+        private:
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+                // offset and length of the pages covering [p, p + bytes) in the mapping.
+                [[nodiscard]] std::pair<size_t, size_t> pages(const uint8_t *p, const size_t bytes) const {
+                        if (this->data_ == nullptr || p < this->data_ || p >= this->data_ + this->size_) {
+                                return {0, 0};
+                        }
+                        const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+                        const size_t begin = size_t(p - this->data_) / page * page;
+                        const size_t end = std::min(size_t(p - this->data_) + bytes, this->size_);
+                        return {begin, end - begin};
+                }
+#endif
+
+                void close() {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+                        if (this->data_ != nullptr) {
+                                UnmapViewOfFile(this->data_);
+                        }
+                        if (this->mapping_ != nullptr) {
+                                CloseHandle(this->mapping_);
+                        }
+                        CloseHandle(this->file_);
+#else
+                        if (this->data_ != nullptr) {
+                                munmap(this->data_, this->size_);
+                        }
+                        ::close(this->fd_);
+#endif
+                        this->data_ = nullptr;
+                }
+        };
+}
+#endif //MI_MAPPED_FILE_HPP
@@ -0,0 +1,89 @@
+/**
+ * @file page_cache.hpp
+ * @brief Hints to the page cache of the kernel.
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ * @note The hints are effective on Linux. They do nothing on the other platforms.
+ */
+#ifndef MI_PAGE_CACHE_HPP
+#define MI_PAGE_CACHE_HPP 1
+
+#include <cstddef>
+#include <filesystem>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mi {
+        /**
+         * @brief Use of the page cache by data streamed once.
+         */
+        enum class cache_policy {
+                keep, ///< left to the kernel
+                drop, ///< read ahead before the stream and dropped behind it
+                direct ///< drop, and files bypass the page cache (O_DIRECT) where supported
+        };
+
+        /**
+         * @brief Hint that the range of the file is read soon, so that the kernel reads it ahead.
+         * @param bytes 0 : to the end of the file.
+         */
+        inline void will_need([[maybe_unused]] const int fd, [[maybe_unused]] const size_t offset = 0, [[maybe_unused]] const size_t bytes = 0) {
+#if defined(__linux__)
+                ::posix_fadvise(fd, off_t(offset), off_t(bytes), POSIX_FADV_WILLNEED);
+#endif
+        }
+
+        /**
+         * @brief Start writing the dirty pages of the range back without waiting for them.
+         * @param bytes 0 : to the end of the file.
+         */
+        inline void write_back([[maybe_unused]] const int fd, [[maybe_unused]] const size_t offset = 0, [[maybe_unused]] const size_t bytes = 0) {
+#if defined(__linux__)
+                ::sync_file_range(fd, off_t(offset), off_t(bytes), SYNC_FILE_RANGE_WRITE);
+#endif
+        }
+
+        /**
+         * @brief Drop the range of the file from the page cache.
+         * @param bytes 0 : to the end of the file.
+         * @param is_written Write the dirty pages back and wait for them first. Otherwise only the clean pages are dropped.
+         */
+        inline void drop_cache([[maybe_unused]] const int fd, [[maybe_unused]] const size_t offset = 0, [[maybe_unused]] const size_t bytes = 0, [[maybe_unused]] const bool is_written = false) {
+#if defined(__linux__)
+                if (is_written) {
+                        ::sync_file_range(fd, off_t(offset), off_t(bytes), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                }
+                ::posix_fadvise(fd, off_t(offset), off_t(bytes), POSIX_FADV_DONTNEED);
+#endif
+        }
+
+        /**
+         * @brief Hint that the file is read soon.
+         */
+        inline void will_need([[maybe_unused]] const std::filesystem::path &path) {
+#if defined(__linux__)
+                if (const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC); fd >= 0) {
+                        mi::will_need(fd);
+                        ::close(fd);
+                }
+#endif
+        }
+
+        /**
+         * @brief Drop the file from the page cache.
+         * @param is_written Write the dirty pages back and wait for them first.
+         */
+        inline void drop_cache([[maybe_unused]] const std::filesystem::path &path, [[maybe_unused]] const bool is_written = false) {
+#if defined(__linux__)
+                if (const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC); fd >= 0) {
+                        mi::drop_cache(fd, 0, 0, is_written);
+                        ::close(fd);
+                }
+#endif
+        }
+}
+#endif //MI_PAGE_CACHE_HPP
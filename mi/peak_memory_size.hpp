@@ -8,8 +8,12 @@
  */
 #ifndef MI_PEAK_MEMORY_SIZE_HPP
 #define MI_PEAK_MEMORY_SIZE_HPP 1
+#include <cstddef>
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
 //ref : https://msdn.microsoft.com/ja-jp/library/windows/desktop/ms682050(v=vs.85).aspx
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <winsock2.h>
 #include <iphlpapi.h>
 #include <windows.h>
@@ -18,11 +22,8 @@
 #include <Psapi.h>
 #pragma comment(lib, "IPHLPAPI.lib")
 #pragma comment(lib, "psapi.lib")
-#elif defined (__APPLE__)
-
-#include <sys/resource.h>
-
 #else
+#include <sys/resource.h>
 #endif
 namespace mi {
         /**
@@ -47,6 +48,12 @@ namespace mi {
                         return 0;    
                 }
 #else
+                // ru_maxrss is in kilobytes on Linux (bytes on macOS).
+                if (rusage ru; getrusage(RUSAGE_SELF, &ru) == 0) {
+                        return size_t(ru.ru_maxrss) * 1024;
+                } else {
+                        return 0;
+                }
 #endif // defined _APPLE_
         }// peak_memory_size
 } //namespace 
@@ -0,0 +1,192 @@
+/**
+ * @file progress_tracker.hpp
+ * @brief Progress of stages sampled by a timer thread.
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_PROGRESS_TRACKER_HPP
+#define MI_PROGRESS_TRACKER_HPP 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "json_string.hpp"
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace mi {
+        /**
+         * @brief Progress of stages with the throughput and the ETA.
+         * @note Workers only add to atomic counters. A timer thread samples them and writes the progress,
+         * so that neither a lock nor an output is taken per item.
+         */
+        class progress_tracker {
+        public:
+                enum class style {
+                        bar, ///< a line rewritten in place (terminals)
+                        json ///< a JSON object per line (logs and job schedulers)
+                };
+        private:
+                using clock = std::chrono::steady_clock;
+
+                std::ostream &out_;
+                style style_;
+                clock::duration interval_;
+                std::atomic<uint64_t> done_{0}, bytes_{0};
+                std::string stage_; ///< empty : no stage in progress
+                std::string unit_;
+                uint64_t total_;
+                clock::time_point begin_;
+                bool is_stopped_;
+                std::mutex mtx_; ///< guards the stage and the output (not taken by add())
+                std::condition_variable cv_;
+                std::thread thread_;
+
+                static std::string hms(const double sec) {
+                        const auto s = uint64_t(sec + 0.5);
+                        std::stringstream ss;
+                        ss << std::setfill('0') << std::setw(2) << s / 3600 << ":" << std::setw(2) << s / 60 % 60 << ":" << std::setw(2) << s % 60;
+                        return ss.str();
+                }
+
+                // write the progress of the stage (mtx_ must be locked).
+                void print(const bool is_final) {
+                        const uint64_t done = std::min(this->done_.load(std::memory_order_relaxed), this->total_);
+                        const uint64_t bytes = this->bytes_.load(std::memory_order_relaxed);
+                        const double elapsed = std::chrono::duration<double>(clock::now() - this->begin_).count();
+                        const double rate = (elapsed > 0) ? double(done) / elapsed : 0;
+                        const double mb_rate = (elapsed > 0) ? double(bytes) * 1.0e-6 / elapsed : 0;
+                        const bool has_eta = (rate > 0);
+                        const double eta = has_eta ? double(this->total_ - done) / rate : 0;
+                        std::stringstream ss;
+                        ss << std::fixed << std::setprecision(1);
+                        if (this->style_ == style::json) {
+                                ss << "{\"stage\": " << mi::json_string(this->stage_) << ", \"unit\": " << mi::json_string(this->unit_) << ", \"done\": " << done << ", \"total\": " << this->total_
+                                   << ", \"bytes\": " << bytes << ", \"elapsed_sec\": " << elapsed << ", \"per_sec\": " << rate << ", \"mb_per_sec\": " << mb_rate << ", \"eta_sec\": ";
+                                if (has_eta) {
+                                        ss << eta;
+                                } else {
+                                        ss << "null";
+                                }
+                                ss << ", \"final\": " << (is_final ? "true" : "false") << "}\n";
+                        } else {
+                                const int num_dots = 20;
+                                const auto dots = size_t(this->total_ > 0 ? done * num_dots / this->total_ : num_dots);
+                                ss << "\033[G" << this->stage_ << ":[" << std::left << std::setw(num_dots) << std::string(dots, '*') << "] (" << done << "/" << this->total_ << ") "
+                                   << rate << " " << this->unit_ << "/s";
+                                if (bytes > 0) {
+                                        ss << ", " << mb_rate << " MB/s";
+                                }
+                                ss << (is_final ? ", " + hms(elapsed) : ", ETA " + (has_eta ? hms(eta) : std::string("--:--:--"))) << "\033[K" << (is_final ? "\n" : "");
+                        }
+                        this->out_ << ss.str() << std::flush;
+                }
+
+                void run() {
+                        std::unique_lock<std::mutex> lock(this->mtx_);
+                        while (!this->is_stopped_) {
+                                if (!this->cv_.wait_for(lock, this->interval_, [this]() { return this->is_stopped_; }) && !this->stage_.empty()) {
+                                        this->print(false);
+                                }
+                        }
+                }
+
+        public:
+                /**
+                 * @brief Whether stderr is a terminal.
+                 */
+                static bool is_terminal() {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+                        return _isatty(_fileno(stderr)) != 0;
+#else
+                        return ::isatty(fileno(stderr)) != 0;
+#endif
+                }
+
+                /**
+                 * @param out Stream of the progress.
+                 * @param s Style of the output.
+                 * @param interval Interval of the samples.
+                 */
+                explicit progress_tracker(std::ostream &out, const style s, const std::chrono::milliseconds interval)
+                        : out_(out), style_(s), interval_(interval), total_(0), is_stopped_(false) {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+                        if (DWORD mode = 0; s == style::bar && GetConsoleMode(GetStdHandle(STD_ERROR_HANDLE), &mode)) {
+                                SetConsoleMode(GetStdHandle(STD_ERROR_HANDLE), mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+                        }
+#endif
+                        this->thread_ = std::thread(&progress_tracker::run, this);
+                }
+
+                progress_tracker(const progress_tracker &that) = delete;
+
+                progress_tracker &operator=(const progress_tracker &that) = delete;
+
+                ~progress_tracker() {
+                        this->end();
+                        {
+                                std::lock_guard<std::mutex> lock(this->mtx_);
+                                this->is_stopped_ = true;
+                        }
+                        this->cv_.notify_all();
+                        this->thread_.join();
+                }
+
+                /**
+                 * @brief Start a stage. The stage in progress is ended.
+                 * @param total The number of items of the stage.
+                 * @param unit Name of the items (e.g., planes).
+                 */
+                void begin(const std::string &stage, const uint64_t total, const std::string &unit = "items") {
+                        this->end();
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        this->stage_ = stage;
+                        this->unit_ = unit;
+                        this->total_ = total;
+                        this->done_ = 0;
+                        this->bytes_ = 0;
+                        this->begin_ = clock::now();
+                        if (this->style_ == style::bar) {
+                                this->print(false);
+                        }
+                }
+
+                /**
+                 * @brief Count finished items and the bytes processed. Called from any thread without locking.
+                 */
+                void add(const uint64_t items, const uint64_t bytes = 0) {
+                        this->done_.fetch_add(items, std::memory_order_relaxed);
+                        this->bytes_.fetch_add(bytes, std::memory_order_relaxed);
+                }
+
+                /**
+                 * @brief End the stage in progress and write its summary.
+                 */
+                void end() {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        if (!this->stage_.empty()) {
+                                this->print(true);
+                                this->stage_.clear();
+                        }
+                }
+        };
+}
+#endif //MI_PROGRESS_TRACKER_HPP
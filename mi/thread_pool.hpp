@@ -0,0 +1,167 @@
+/**
+ * @file thread_pool.hpp
+ * @brief
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_THREAD_POOL_HPP
+#define MI_THREAD_POOL_HPP 1
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mi {
+        /**
+         * @brief Persistent worker threads running loops in parallel.
+         * @note Indices of a loop are handed out by an atomic counter, so that no lock is taken per item.
+         * The mutex is taken only when a loop is posted and when a worker looks for a loop.
+         * Loops can be posted from several threads (or from the loop body) at once. The posting thread runs its own loop as well,
+         * so that a loop is completed even if all workers are busy with other loops.
+         */
+        class thread_pool {
+        private:
+                struct loop {
+                        std::function<void(size_t)> fn;
+                        size_t end = 0;
+                        size_t max_threads = 0; ///< 0 : no limit
+                        std::atomic<size_t> next{0}; ///< the index handed out next
+                        std::atomic<size_t> done{0}; ///< the number of finished indices
+                        size_t threads = 1; ///< threads joined (guarded by mtx_). The posting thread is counted.
+                        std::exception_ptr error;
+                        std::mutex error_mtx;
+
+                        [[nodiscard]] bool is_joinable() const {
+                                return this->next.load() < this->end && (this->max_threads == 0 || this->threads < this->max_threads);
+                        }
+
+                        void run() {
+                                for (size_t i = this->next.fetch_add(1); i < this->end; i = this->next.fetch_add(1)) {
+                                        try {
+                                                this->fn(i);
+                                        } catch (...) {
+                                                std::lock_guard<std::mutex> lock(this->error_mtx);
+                                                if (!this->error) {
+                                                        this->error = std::current_exception();
+                                                }
+                                        }
+                                        if (this->done.fetch_add(1) + 1 == this->end) {
+                                                this->done.notify_all();
+                                        }
+                                }
+                        }
+                };
+
+                std::vector<std::thread> workers_;
+                std::list<std::shared_ptr<loop>> loops_; ///< loops having indices not handed out yet
+                std::mutex mtx_;
+                std::condition_variable cv_;
+                bool is_stopped_;
+
+                // the first loop a worker can join. Exhausted loops are removed. (mtx_ must be locked)
+                std::shared_ptr<loop> find_loop() {
+                        std::erase_if(this->loops_, [](auto &l) { return l->next.load() >= l->end; });
+                        auto it = std::find_if(this->loops_.begin(), this->loops_.end(), [](auto &l) { return l->is_joinable(); });
+                        return it == this->loops_.end() ? nullptr : *it;
+                }
+
+                void work() {
+                        for (;;) {
+                                std::shared_ptr<loop> l;
+                                {
+                                        std::unique_lock<std::mutex> lock(this->mtx_);
+                                        this->cv_.wait(lock, [this, &l]() { return this->is_stopped_ || (l = this->find_loop()) != nullptr; });
+                                        if (!l) {
+                                                return;
+                                        }
+                                        ++l->threads;
+                                }
+                                l->run();
+                        }
+                }
+
+        public:
+                /**
+                 * @param n The number of threads running a loop including the posting thread. 0 : hardware concurrency.
+                 */
+                explicit thread_pool(size_t n = 0) : is_stopped_(false) {
+                        if (n == 0) {
+                                n = std::max(std::thread::hardware_concurrency(), 1u);
+                        }
+                        for (size_t i = 1; i < n; ++i) {
+                                this->workers_.emplace_back(&thread_pool::work, this);
+                        }
+                }
+
+                thread_pool(const thread_pool &that) = delete;
+
+                thread_pool(thread_pool &&that) = delete;
+
+                thread_pool &operator=(const thread_pool &that) = delete;
+
+                thread_pool &operator=(thread_pool &&that) = delete;
+
+                ~thread_pool() {
+                        {
+                                std::lock_guard<std::mutex> lock(this->mtx_);
+                                this->is_stopped_ = true;
+                        }
+                        this->cv_.notify_all();
+                        std::for_each(this->workers_.begin(), this->workers_.end(), [](auto &t) { t.join(); });
+                }
+
+                /**
+                 * @brief The number of threads running a loop (workers and the posting thread).
+                 */
+                [[nodiscard]] size_t size() const {
+                        return this->workers_.size() + 1;
+                }
+
+                /**
+                 * @brief Call fn(i) for i in [0, n) in parallel and wait for all of them.
+                 * @param max_threads The maximum number of threads running the loop. 0 : size().
+                 * @throw The first exception thrown by fn. The other indices are processed anyway.
+                 */
+                template<typename Function>
+                void parallel_for(const size_t n, Function fn, const size_t max_threads = 0) {
+                        if (n == 0) {
+                                return;
+                        }
+                        auto l = std::make_shared<loop>();
+                        l->fn = std::move(fn);
+                        l->end = n;
+                        l->max_threads = max_threads;
+                        if (n > 1 && max_threads != 1 && !this->workers_.empty()) {
+                                {
+                                        std::lock_guard<std::mutex> lock(this->mtx_);
+                                        this->loops_.push_back(l);
+                                }
+                                if (max_threads == 0 || max_threads > n) {
+                                        this->cv_.notify_all();
+                                } else {
+                                        for (size_t i = 1; i < max_threads; ++i) {
+                                                this->cv_.notify_one();
+                                        }
+                                }
+                        }
+                        l->run();
+                        for (size_t d = l->done.load(); d < n; d = l->done.load()) {
+                                l->done.wait(d);
+                        }
+                        if (l->error) {
+                                std::rethrow_exception(l->error);
+                        }
+                }
+        };
+}
+#endif //MI_THREAD_POOL_HPP
@@ -0,0 +1,523 @@
+/**
+ * @file tiff.hpp
+ * @brief Minimal TIFF / BigTIFF container reader and writer.
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ * @note Only the container (IFDs, strips and tiles) is handled. Pixels are not decoded.
+ */
+#ifndef MI_TIFF_HPP
+#define MI_TIFF_HPP 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mapped_file.hpp"
+
+namespace mi {
+        namespace tiff_tag {
+                constexpr uint16_t new_subfile_type = 254;
+                constexpr uint16_t image_width = 256;
+                constexpr uint16_t image_length = 257;
+                constexpr uint16_t bits_per_sample = 258;
+                constexpr uint16_t compression = 259;
+                constexpr uint16_t photometric = 262;
+                constexpr uint16_t strip_offsets = 273;
+                constexpr uint16_t samples_per_pixel = 277;
+                constexpr uint16_t rows_per_strip = 278;
+                constexpr uint16_t strip_byte_counts = 279;
+                constexpr uint16_t x_resolution = 282;
+                constexpr uint16_t y_resolution = 283;
+                constexpr uint16_t planar_config = 284;
+                constexpr uint16_t free_offsets = 288;
+                constexpr uint16_t free_byte_counts = 289;
+                constexpr uint16_t resolution_unit = 296;
+                constexpr uint16_t predictor = 317;
+                constexpr uint16_t tile_width = 322;
+                constexpr uint16_t tile_length = 323;
+                constexpr uint16_t tile_offsets = 324;
+                constexpr uint16_t tile_byte_counts = 325;
+                constexpr uint16_t sub_ifds = 330;
+                constexpr uint16_t extra_samples = 338;
+                constexpr uint16_t sample_format = 339;
+                constexpr uint16_t jpeg_if_offset = 513;
+                constexpr uint16_t jpeg_if_byte_count = 514;
+                constexpr uint16_t exif_ifd = 34665;
+                constexpr uint16_t gps_ifd = 34853;
+        }
+
+        namespace tiff_type {
+                constexpr uint16_t byte = 1;
+                constexpr uint16_t ascii = 2;
+                constexpr uint16_t short_ = 3;
+                constexpr uint16_t long_ = 4;
+                constexpr uint16_t rational = 5;
+                constexpr uint16_t long8 = 16;
+
+                /// bytes of a value of the type (0 for unknown types).
+                inline size_t size(const uint16_t type) {
+                        switch (type) {
+                                case 1: case 2: case 6: case 7:
+                                        return 1;
+                                case 3: case 8:
+                                        return 2;
+                                case 4: case 9: case 11: case 13:
+                                        return 4;
+                                case 5: case 10: case 12: case 16: case 17: case 18:
+                                        return 8;
+                                default:
+                                        return 0;
+                        }
+                }
+        }
+
+        /**
+         * @brief Byte order of a TIFF file.
+         */
+        class tiff_byte_order {
+        private:
+                bool big_endian_;
+        public:
+                explicit tiff_byte_order(const bool big_endian = false) : big_endian_(big_endian) {}
+
+                [[nodiscard]] bool is_big_endian() const {
+                        return this->big_endian_;
+                }
+
+                [[nodiscard]] uint64_t get(const uint8_t *p, const size_t bytes) const {
+                        uint64_t v = 0;
+                        for (size_t i = 0; i < bytes; ++i) {
+                                const uint64_t b = p[this->big_endian_ ? i : bytes - 1 - i];
+                                v = (v << 8) | b;
+                        }
+                        return v;
+                }
+
+                void put(uint8_t *p, const uint64_t v, const size_t bytes) const {
+                        for (size_t i = 0; i < bytes; ++i) {
+                                p[this->big_endian_ ? bytes - 1 - i : i] = uint8_t(v >> (8 * i));
+                        }
+                }
+        };
+
+        /**
+         * @brief IFD entry. Values are kept as raw bytes in the byte order of the file.
+         */
+        struct tiff_entry {
+                uint16_t tag = 0;
+                uint16_t type = 0;
+                uint64_t count = 0;
+                std::vector<uint8_t> data;
+        };
+
+        /**
+         * @brief Image file directory (a page).
+         */
+        class tiff_page {
+        private:
+                tiff_byte_order order_;
+                std::vector<tiff_entry> entries_;
+        public:
+                tiff_page(const tiff_byte_order &order, std::vector<tiff_entry> entries) : order_(order), entries_(std::move(entries)) {}
+
+                [[nodiscard]] const std::vector<tiff_entry> &entries() const {
+                        return this->entries_;
+                }
+
+                [[nodiscard]] const tiff_entry *find(const uint16_t tag) const {
+                        auto it = std::find_if(this->entries_.begin(), this->entries_.end(), [&tag](auto &e) { return e.tag == tag; });
+                        return it == this->entries_.end() ? nullptr : &(*it);
+                }
+
+                /**
+                 * @brief Get an integer value.
+                 * @param default_value Returned when the tag does not exist.
+                 */
+                [[nodiscard]] uint64_t get(const uint16_t tag, const size_t i = 0, const uint64_t default_value = 0) const {
+                        const tiff_entry *e = this->find(tag);
+                        if (e == nullptr || i >= e->count) {
+                                return default_value;
+                        }
+                        const size_t bytes = tiff_type::size(e->type);
+                        return this->order_.get(e->data.data() + i * bytes, std::min<size_t>(bytes, 8));
+                }
+
+                [[nodiscard]] std::vector<uint64_t> get_all(const uint16_t tag) const {
+                        std::vector<uint64_t> values;
+                        if (const tiff_entry *e = this->find(tag); e != nullptr) {
+                                for (size_t i = 0; i < e->count; ++i) {
+                                        values.push_back(this->get(tag, i));
+                                }
+                        }
+                        return values;
+                }
+
+                [[nodiscard]] uint32_t width() const {
+                        return uint32_t(this->get(tiff_tag::image_width));
+                }
+
+                [[nodiscard]] uint32_t height() const {
+                        return uint32_t(this->get(tiff_tag::image_length));
+                }
+
+                [[nodiscard]] uint32_t samples() const {
+                        return uint32_t(this->get(tiff_tag::samples_per_pixel, 0, 1));
+                }
+
+                [[nodiscard]] uint32_t bits() const {
+                        return uint32_t(this->get(tiff_tag::bits_per_sample, 0, 1));
+                }
+
+                [[nodiscard]] uint32_t compression() const {
+                        return uint32_t(this->get(tiff_tag::compression, 0, 1));
+                }
+
+                [[nodiscard]] bool is_tiled() const {
+                        return this->find(tiff_tag::tile_offsets) != nullptr;
+                }
+
+                [[nodiscard]] uint32_t rows_per_strip() const {
+                        return uint32_t(std::min<uint64_t>(this->get(tiff_tag::rows_per_strip, 0, this->height()), this->height()));
+                }
+        };
+
+        /**
+         * @brief Reader of TIFF and BigTIFF. The IFD chain is walked once in the constructor.
+         * @note The file is memory-mapped and all accessors are thread safe.
+         */
+        class tiff_reader {
+        private:
+                std::unique_ptr<mapped_file> file_;
+                const uint8_t *data_;
+                size_t size_;
+                tiff_byte_order order_;
+                bool is_bigtiff_;
+                std::vector<tiff_page> pages_;
+
+                [[nodiscard]] uint64_t get(const uint64_t offset, const size_t bytes) const {
+                        if (offset > this->size_ || bytes > this->size_ - offset) { // without overflow
+                                throw std::runtime_error("Broken TIFF (offset out of range).");
+                        }
+                        return this->order_.get(this->data_ + offset, bytes);
+                }
+
+                void parse() {
+                        if (this->size_ < 8 || !((this->data_[0] == 'I' && this->data_[1] == 'I') || (this->data_[0] == 'M' && this->data_[1] == 'M'))) {
+                                throw std::runtime_error("Not a TIFF file.");
+                        }
+                        this->order_ = tiff_byte_order(this->data_[0] == 'M');
+                        const auto version = this->get(2, 2);
+                        if (version != 42 && version != 43) {
+                                throw std::runtime_error("Not a TIFF file.");
+                        }
+                        this->is_bigtiff_ = (version == 43);
+                        const size_t offset_size = this->is_bigtiff_ ? 8 : 4;
+                        const size_t count_size = this->is_bigtiff_ ? 8 : 2;
+                        const size_t entry_size = this->is_bigtiff_ ? 20 : 12;
+                        std::set<uint64_t> visited;
+                        for (uint64_t ifd = this->get(this->is_bigtiff_ ? 8 : 4, offset_size); ifd != 0; ) {
+                                if (!visited.insert(ifd).second) {
+                                        throw std::runtime_error("Broken TIFF (IFD loop).");
+                                }
+                                const uint64_t n = this->get(ifd, count_size);
+                                if (n > (this->size_ - ifd - count_size) / entry_size) {
+                                        throw std::runtime_error("Broken TIFF (IFD out of range).");
+                                }
+                                std::vector<tiff_entry> entries;
+                                for (uint64_t i = 0; i < n; ++i) {
+                                        const uint64_t p = ifd + count_size + i * entry_size;
+                                        tiff_entry e;
+                                        e.tag = uint16_t(this->get(p, 2));
+                                        e.type = uint16_t(this->get(p + 2, 2));
+                                        e.count = this->get(p + 4, offset_size);
+                                        const size_t type_size = tiff_type::size(e.type);
+                                        if (type_size == 0) {
+                                                continue; // unknown type is ignored.
+                                        }
+                                        if (e.count > this->size_ / type_size) { // the values cannot be in the file
+                                                throw std::runtime_error("Broken TIFF (value out of range).");
+                                        }
+                                        const size_t bytes = type_size * e.count;
+                                        const uint64_t value = (bytes <= offset_size) ? p + 4 + offset_size : this->get(p + 4 + offset_size, offset_size);
+                                        if (value > this->size_ || bytes > this->size_ - value) {
+                                                throw std::runtime_error("Broken TIFF (value out of range).");
+                                        }
+                                        e.data.assign(this->data_ + value, this->data_ + value + bytes);
+                                        entries.push_back(std::move(e));
+                                }
+                                this->pages_.emplace_back(this->order_, std::move(entries));
+                                ifd = this->get(ifd + count_size + n * entry_size, offset_size);
+                        }
+                }
+
+        public:
+                /**
+                 * @brief Open a file.
+                 * @throw runtime_error if the file is not a TIFF.
+                 */
+                explicit tiff_reader(const std::filesystem::path &path) : file_(std::make_unique<mapped_file>(path)), data_(file_->data()), size_(file_->size()), is_bigtiff_(false) {
+                        this->parse();
+                }
+
+                /**
+                 * @brief Read a TIFF on the memory. The buffer must be alive while the reader is used.
+                 */
+                tiff_reader(const uint8_t *data, const size_t size) : data_(data), size_(size), is_bigtiff_(false) {
+                        this->parse();
+                }
+
+                [[nodiscard]] size_t pages() const {
+                        return this->pages_.size();
+                }
+
+                [[nodiscard]] const tiff_page &page(const size_t i) const {
+                        return this->pages_.at(i);
+                }
+
+                [[nodiscard]] bool is_bigtiff() const {
+                        return this->is_bigtiff_;
+                }
+
+                [[nodiscard]] const tiff_byte_order &byte_order() const {
+                        return this->order_;
+                }
+
+                /**
+                 * @brief Strips (or tiles) of the page.
+                 * @return pairs of the pointer and the size in bytes.
+                 */
+                [[nodiscard]] std::vector<std::pair<const uint8_t *, size_t>> chunks(const size_t i) const {
+                        const tiff_page &p = this->page(i);
+                        const bool is_tiled = p.is_tiled();
+                        const auto offsets = p.get_all(is_tiled ? tiff_tag::tile_offsets : tiff_tag::strip_offsets);
+                        const auto counts = p.get_all(is_tiled ? tiff_tag::tile_byte_counts : tiff_tag::strip_byte_counts);
+                        if (offsets.size() != counts.size()) {
+                                throw std::runtime_error("Broken TIFF (strips).");
+                        }
+                        std::vector<std::pair<const uint8_t *, size_t>> result;
+                        for (size_t j = 0; j < offsets.size(); ++j) {
+                                if (offsets[j] > this->size_ || counts[j] > this->size_ - offsets[j]) {
+                                        throw std::runtime_error("Broken TIFF (strip out of range).");
+                                }
+                                result.emplace_back(this->data_ + offsets[j], size_t(counts[j]));
+                        }
+                        return result;
+                }
+
+                /**
+                 * @brief Hint that the pages [begin, end) are read soon. No effect on a TIFF on the memory.
+                 */
+                void will_need(const size_t begin, const size_t end) const {
+                        this->for_each_page(begin, end, [this](const uint8_t *p, const size_t bytes) { this->file_->will_need(p, bytes); });
+                }
+
+                /**
+                 * @brief Drop the pages [begin, end) from the page cache. No effect on a TIFF on the memory.
+                 */
+                void drop(const size_t begin, const size_t end) const {
+                        this->for_each_page(begin, end, [this](const uint8_t *p, const size_t bytes) { this->file_->drop(p, bytes); });
+                }
+
+        private:
+                // call fn(p, bytes) with the range covering the strips of each page. Broken pages are skipped.
+                template<typename Function>
+                void for_each_page(const size_t begin, const size_t end, Function fn) const {
+                        if (!this->file_) {
+                                return;
+                        }
+                        for (size_t i = begin; i < std::min(end, this->pages()); ++i) {
+                                try {
+                                        const auto c = this->chunks(i);
+                                        if (c.empty()) {
+                                                continue;
+                                        }
+                                        const auto [lo, hi] = std::minmax_element(c.begin(), c.end(), [](auto &a, auto &b) { return a.first < b.first; });
+                                        fn(lo->first, size_t(hi->first - lo->first) + hi->second);
+                                } catch (std::exception &) {
+                                        // reported when the page is read
+                                }
+                        }
+                }
+        };
+
+        /**
+         * @brief Sequential writer of TIFF and BigTIFF.
+         * @note Pages are appended to the stream. Strip (or tile) data precede their IFD.
+         */
+        class tiff_writer {
+        private:
+                std::ostream &out_;
+                tiff_byte_order order_;
+                bool is_bigtiff_;
+                uint64_t pos_;
+                uint64_t next_ifd_pos_; ///< position of the pointer to the next IFD.
+
+                void write_value(const uint64_t v, const size_t bytes) {
+                        uint8_t buf[8];
+                        this->order_.put(buf, v, bytes);
+                        this->write(buf, bytes);
+                }
+
+                void write(const uint8_t *data, const size_t bytes) {
+                        this->out_.write(reinterpret_cast<const char *>(data), std::streamsize(bytes));
+                        this->pos_ += bytes;
+                }
+
+                void align() {
+                        if (this->pos_ % 2 != 0) {
+                                this->write_value(0, 1); // word boundary
+                        }
+                }
+
+        public:
+                /**
+                 * @param is_bigtiff Write BigTIFF (64-bit offsets).
+                 * @param order Byte order. Raw values of the entries must be in this order.
+                 */
+                explicit tiff_writer(std::ostream &out, const bool is_bigtiff = false, const tiff_byte_order &order = tiff_byte_order()) : out_(out), order_(order), is_bigtiff_(is_bigtiff), pos_(0) {
+                        const uint8_t magic = this->order_.is_big_endian() ? 'M' : 'I';
+                        this->write(&magic, 1);
+                        this->write(&magic, 1);
+                        this->write_value(is_bigtiff ? 43 : 42, 2);
+                        if (is_bigtiff) {
+                                this->write_value(8, 2); // offset size
+                                this->write_value(0, 2);
+                        }
+                        this->next_ifd_pos_ = this->pos_;
+                        this->write_value(0, is_bigtiff ? 8 : 4);
+                }
+
+                tiff_writer(const tiff_writer &that) = delete;
+
+                tiff_writer &operator=(const tiff_writer &that) = delete;
+
+                ~tiff_writer() = default;
+
+                /**
+                 * @brief Append a page.
+                 * @param entries IFD entries except the offsets and the byte counts of chunks.
+                 * @param chunks Strips (or tiles) of the page.
+                 * @param is_tiled Write TileOffsets/TileByteCounts instead of StripOffsets/StripByteCounts.
+                 * @throw runtime_error if the stream fails.
+                 */
+                void append(std::vector<tiff_entry> entries, const std::vector<std::pair<const uint8_t *, size_t>> &chunks, const bool is_tiled = false) {
+                        const size_t offset_size = this->is_bigtiff_ ? 8 : 4;
+                        tiff_entry offsets{is_tiled ? tiff_tag::tile_offsets : tiff_tag::strip_offsets, this->is_bigtiff_ ? tiff_type::long8 : tiff_type::long_, chunks.size(), {}};
+                        tiff_entry counts{is_tiled ? tiff_tag::tile_byte_counts : tiff_tag::strip_byte_counts, offsets.type, chunks.size(), {}};
+                        offsets.data.resize(chunks.size() * offset_size);
+                        counts.data.resize(chunks.size() * offset_size);
+                        for (size_t i = 0; i < chunks.size(); ++i) {
+                                this->align();
+                                if (!this->is_bigtiff_ && this->pos_ + chunks[i].second > UINT32_MAX) {
+                                        throw std::runtime_error("TIFF exceeds 4GB. Use BigTIFF.");
+                                }
+                                this->order_.put(offsets.data.data() + i * offset_size, this->pos_, offset_size);
+                                this->order_.put(counts.data.data() + i * offset_size, chunks[i].second, offset_size);
+                                this->write(chunks[i].first, chunks[i].second);
+                        }
+                        entries.erase(std::remove_if(entries.begin(), entries.end(), [&offsets, &counts](auto &e) { return e.tag == offsets.tag || e.tag == counts.tag; }), entries.end());
+                        entries.push_back(std::move(offsets));
+                        entries.push_back(std::move(counts));
+                        std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) { return a.tag < b.tag; });
+
+                        // values which do not fit in the entries
+                        std::vector<uint64_t> value_pos(entries.size(), 0);
+                        for (size_t i = 0; i < entries.size(); ++i) {
+                                if (entries[i].data.size() > offset_size) {
+                                        this->align();
+                                        value_pos[i] = this->pos_;
+                                        this->write(entries[i].data.data(), entries[i].data.size());
+                                }
+                        }
+                        this->align();
+                        const uint64_t ifd = this->pos_;
+                        this->write_value(entries.size(), this->is_bigtiff_ ? 8 : 2);
+                        for (size_t i = 0; i < entries.size(); ++i) {
+                                const tiff_entry &e = entries[i];
+                                this->write_value(e.tag, 2);
+                                this->write_value(e.type, 2);
+                                this->write_value(e.count, offset_size);
+                                if (e.data.size() > offset_size) {
+                                        this->write_value(value_pos[i], offset_size);
+                                } else {
+                                        uint8_t buf[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+                                        std::copy(e.data.begin(), e.data.end(), buf);
+                                        this->write(buf, offset_size);
+                                }
+                        }
+                        const uint64_t next = this->pos_;
+                        this->write_value(0, offset_size);
+                        if (!this->is_bigtiff_ && this->pos_ > UINT32_MAX) {
+                                throw std::runtime_error("TIFF exceeds 4GB. Use BigTIFF.");
+                        }
+                        // link from the previous IFD
+                        this->out_.seekp(std::streamoff(this->next_ifd_pos_));
+                        uint8_t buf[8];
+                        this->order_.put(buf, ifd, offset_size);
+                        this->out_.write(reinterpret_cast<const char *>(buf), std::streamsize(offset_size));
+                        this->out_.seekp(std::streamoff(this->pos_));
+                        this->next_ifd_pos_ = next;
+                        if (!this->out_) {
+                                throw std::runtime_error("TIFF cannot be written.");
+                        }
+                }
+        };
+
+        /**
+         * @brief Extract a page as a standalone TIFF on the memory (e.g., for passing it to a decoder).
+         * @param rows Rows of strips [begin, end) to be extracted. All rows when begin == end.
+         * @note Tags referring other IFDs (Exif, SubIFDs, ...) are dropped.
+         * @throw runtime_error if the page has fewer strips than its rows.
+         */
+        inline std::string extract_tiff_page(const tiff_reader &reader, const size_t i, const uint32_t begin = 0, const uint32_t end = 0) {
+                const tiff_page &page = reader.page(i);
+                const uint16_t dropped[] = {tiff_tag::strip_offsets, tiff_tag::strip_byte_counts, tiff_tag::tile_offsets, tiff_tag::tile_byte_counts, tiff_tag::free_offsets,
+                                            tiff_tag::free_byte_counts, tiff_tag::sub_ifds, tiff_tag::jpeg_if_offset, tiff_tag::jpeg_if_byte_count, tiff_tag::exif_ifd, tiff_tag::gps_ifd};
+                std::vector<tiff_entry> entries;
+                std::copy_if(page.entries().begin(), page.entries().end(), std::back_inserter(entries), [&dropped](auto &e) {
+                        return std::find(std::begin(dropped), std::end(dropped), e.tag) == std::end(dropped);
+                });
+                auto chunks = reader.chunks(i);
+                if (begin < end && !page.is_tiled()) {
+                        // with PlanarConfiguration = 2, the strips of the samples are stored one plane after another.
+                        const size_t rps = std::max(page.rows_per_strip(), 1u);
+                        const size_t strips = (size_t(page.height()) + rps - 1) / rps; // strips of a plane
+                        const size_t planes = (page.get(tiff_tag::planar_config, 0, 1) == 2) ? page.samples() : 1;
+                        const size_t s0 = begin / rps;
+                        const size_t s1 = std::min((size_t(end) + rps - 1) / rps, strips);
+                        if (s0 >= s1 || chunks.size() < strips * planes) {
+                                throw std::runtime_error("Broken TIFF (strips).");
+                        }
+                        std::vector<std::pair<const uint8_t *, size_t>> selected;
+                        for (size_t p = 0; p < planes; ++p) {
+                                selected.insert(selected.end(), chunks.begin() + std::ptrdiff_t(p * strips + s0), chunks.begin() + std::ptrdiff_t(p * strips + s1));
+                        }
+                        chunks = std::move(selected);
+                        for (auto &e: entries) {
+                                if (e.tag == tiff_tag::image_length) {
+                                        const auto rows = uint32_t(std::min<size_t>(s1 * rps, page.height()) - s0 * rps);
+                                        e.type = tiff_type::long_;
+                                        e.count = 1;
+                                        e.data.assign(4, 0);
+                                        reader.byte_order().put(e.data.data(), rows, 4);
+                                }
+                        }
+                }
+                std::ostringstream ss;
+                tiff_writer writer(ss, reader.is_bigtiff(), reader.byte_order());
+                writer.append(entries, chunks, page.is_tiled());
+                return ss.str();
+        }
+}
+#endif //MI_TIFF_HPP
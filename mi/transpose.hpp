@@ -0,0 +1,281 @@
+/**
+ * @file transpose.hpp
+ * @brief Cache-blocked transpose of images.
+ * @author Takashi Michikawa <tmichi@me.com>
+ * @copyright (c) 2023 -  Takashi Michikawa
+ * Released under the MIT license
+ * https://opensource.org/licenses/mit-license.php
+ */
+#ifndef MI_TRANSPOSE_HPP
+#define MI_TRANSPOSE_HPP 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace mi {
+        namespace detail {
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || defined(__AVX2__)
+#define MI_TRANSPOSE_SIMD 1
+                using vec128 = __m128i;
+
+                inline vec128 load128(const uint8_t *p) {
+                        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                }
+
+                inline void store128(uint8_t *p, const vec128 v) {
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+                }
+
+                template<int Bits>
+                inline void zip(const vec128 a, const vec128 b, vec128 &lo, vec128 &hi) {
+                        if constexpr (Bits == 8) {
+                                lo = _mm_unpacklo_epi8(a, b);
+                                hi = _mm_unpackhi_epi8(a, b);
+                        } else if constexpr (Bits == 16) {
+                                lo = _mm_unpacklo_epi16(a, b);
+                                hi = _mm_unpackhi_epi16(a, b);
+                        } else if constexpr (Bits == 32) {
+                                lo = _mm_unpacklo_epi32(a, b);
+                                hi = _mm_unpackhi_epi32(a, b);
+                        } else {
+                                lo = _mm_unpacklo_epi64(a, b);
+                                hi = _mm_unpackhi_epi64(a, b);
+                        }
+                }
+#elif defined(__ARM_NEON)
+#define MI_TRANSPOSE_SIMD 1
+                using vec128 = uint8x16_t;
+
+                inline vec128 load128(const uint8_t *p) {
+                        return vld1q_u8(p);
+                }
+
+                inline void store128(uint8_t *p, const vec128 v) {
+                        vst1q_u8(p, v);
+                }
+
+                template<int Bits>
+                inline void zip(const vec128 a, const vec128 b, vec128 &lo, vec128 &hi) {
+                        if constexpr (Bits == 8) {
+                                const uint8x16x2_t z = vzipq_u8(a, b);
+                                lo = z.val[0];
+                                hi = z.val[1];
+                        } else if constexpr (Bits == 16) {
+                                const uint16x8x2_t z = vzipq_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b));
+                                lo = vreinterpretq_u8_u16(z.val[0]);
+                                hi = vreinterpretq_u8_u16(z.val[1]);
+                        } else if constexpr (Bits == 32) {
+                                const uint32x4x2_t z = vzipq_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b));
+                                lo = vreinterpretq_u8_u32(z.val[0]);
+                                hi = vreinterpretq_u8_u32(z.val[1]);
+                        } else {
+                                const uint64x2_t a64 = vreinterpretq_u64_u8(a);
+                                const uint64x2_t b64 = vreinterpretq_u64_u8(b);
+                                lo = vreinterpretq_u8_u64(vcombine_u64(vget_low_u64(a64), vget_low_u64(b64)));
+                                hi = vreinterpretq_u8_u64(vcombine_u64(vget_high_u64(a64), vget_high_u64(b64)));
+                        }
+                }
+#endif
+
+                /**
+                 * @brief Transpose of a square tile of pixels with N bytes.
+                 * @note size is 0 when no SIMD kernel is available for the pixel size.
+                 */
+                template<size_t N>
+                struct transpose_tile {
+                        static constexpr int size = 0;
+
+                        static void run(const uint8_t *const *, const int, uint8_t *const *, const int) {}
+                };
+#if defined(MI_TRANSPOSE_SIMD)
+                /**
+                 * @brief 128-bit kernel. Rows i and i + n/2 are interleaved log2(n) times (perfect shuffle).
+                 */
+                template<size_t N>
+                struct transpose_tile128 {
+                        static constexpr int size = int(16 / N);
+
+                        static void run(const uint8_t *const *src, const int c, uint8_t *const *dst, const int r) {
+                                vec128 v[size], t[size];
+                                for (int i = 0; i < size; ++i) {
+                                        v[i] = load128(src[i] + c * N);
+                                }
+                                for (int n = 1; n < size; n *= 2) {
+                                        for (int i = 0; i < size / 2; ++i) {
+                                                zip<int(N * 8)>(v[i], v[i + size / 2], t[2 * i], t[2 * i + 1]);
+                                        }
+                                        std::copy(t, t + size, v);
+                                }
+                                for (int i = 0; i < size; ++i) {
+                                        store128(dst[i] + r * N, v[i]);
+                                }
+                        }
+                };
+
+                template<>
+                struct transpose_tile<1> : public transpose_tile128<1> {};
+
+                template<>
+                struct transpose_tile<2> : public transpose_tile128<2> {};
+#if defined(__AVX2__)
+                /**
+                 * @brief 8x8 tile of 32-bit pixels (e.g., 8-bit 4 channels).
+                 */
+                template<>
+                struct transpose_tile<4> {
+                        static constexpr int size = 8;
+
+                        static void run(const uint8_t *const *src, const int c, uint8_t *const *dst, const int r) {
+                                __m256i v[8], t[8];
+                                for (int i = 0; i < 8; ++i) {
+                                        v[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src[i] + c * 4));
+                                }
+                                for (int i = 0; i < 8; i += 2) {
+                                        t[i] = _mm256_unpacklo_epi32(v[i], v[i + 1]);
+                                        t[i + 1] = _mm256_unpackhi_epi32(v[i], v[i + 1]);
+                                }
+                                for (int i = 0; i < 8; i += 4) {
+                                        v[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+                                        v[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+                                        v[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+                                        v[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+                                }
+                                for (int i = 0; i < 4; ++i) {
+                                        t[i] = _mm256_permute2x128_si256(v[i], v[i + 4], 0x20);
+                                        t[i + 4] = _mm256_permute2x128_si256(v[i], v[i + 4], 0x31);
+                                }
+                                for (int i = 0; i < 8; ++i) {
+                                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst[i] + r * 4), t[i]);
+                                }
+                        }
+                };
+
+                /**
+                 * @brief 4x4 tile of 64-bit pixels (e.g., 16-bit 4 channels).
+                 */
+                template<>
+                struct transpose_tile<8> {
+                        static constexpr int size = 4;
+
+                        static void run(const uint8_t *const *src, const int c, uint8_t *const *dst, const int r) {
+                                __m256i v[4], t[4];
+                                for (int i = 0; i < 4; ++i) {
+                                        v[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src[i] + c * 8));
+                                }
+                                t[0] = _mm256_unpacklo_epi64(v[0], v[1]);
+                                t[1] = _mm256_unpackhi_epi64(v[0], v[1]);
+                                t[2] = _mm256_unpacklo_epi64(v[2], v[3]);
+                                t[3] = _mm256_unpackhi_epi64(v[2], v[3]);
+                                v[0] = _mm256_permute2x128_si256(t[0], t[2], 0x20);
+                                v[1] = _mm256_permute2x128_si256(t[1], t[3], 0x20);
+                                v[2] = _mm256_permute2x128_si256(t[0], t[2], 0x31);
+                                v[3] = _mm256_permute2x128_si256(t[1], t[3], 0x31);
+                                for (int i = 0; i < 4; ++i) {
+                                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst[i] + r * 8), v[i]);
+                                }
+                        }
+                };
+#else
+                template<>
+                struct transpose_tile<4> : public transpose_tile128<4> {};
+
+                template<>
+                struct transpose_tile<8> : public transpose_tile128<8> {};
+#endif // __AVX2__
+#endif // MI_TRANSPOSE_SIMD
+
+                template<size_t N>
+                inline void transpose_scalar(const uint8_t *const *src, uint8_t *const *dst, const int r0, const int r1, const int c0, const int c1) {
+                        for (int c = c0; c < c1; ++c) {
+                                uint8_t *d = dst[c];
+                                for (int r = r0; r < r1; ++r) {
+                                        std::memcpy(d + r * N, src[r] + c * N, N);
+                                }
+                        }
+                }
+
+                /**
+                 * @brief Blocks of 64x64 pixels are transposed one by one so that both of them stay in L1/L2 cache.
+                 */
+                template<size_t N>
+                inline void transpose(const uint8_t *const *src, uint8_t *const *dst, const int rows, const int cols) {
+                        constexpr int block = 64;
+                        constexpr int tile = transpose_tile<N>::size;
+                        for (int r0 = 0; r0 < rows; r0 += block) {
+                                const int r1 = std::min(r0 + block, rows);
+                                for (int c0 = 0; c0 < cols; c0 += block) {
+                                        const int c1 = std::min(c0 + block, cols);
+                                        int r = r0;
+                                        if constexpr (tile > 0) {
+                                                for (; r + tile <= r1; r += tile) {
+                                                        int c = c0;
+                                                        for (; c + tile <= c1; c += tile) {
+                                                                transpose_tile<N>::run(src + r, c, dst + c, r);
+                                                        }
+                                                        transpose_scalar<N>(src, dst, r, r + tile, c, c1);
+                                                }
+                                        }
+                                        transpose_scalar<N>(src, dst, r, r1, c0, c1);
+                                }
+                        }
+                }
+        }
+
+        /**
+         * @brief Transpose pixels, i.e., dst_rows[c][r] = src_rows[r][c].
+         * @param src_rows Pointers to the rows of the source (rows).
+         * @param dst_rows Pointers to the rows of the destination (cols).
+         * @param pixel_size Bytes per pixel.
+         * @note SIMD kernels are used for 1, 2, 4 and 8 bytes pixels. Others are transposed by the blocked scalar loop.
+         */
+        inline void transpose(const uint8_t *const *src_rows, uint8_t *const *dst_rows, const int rows, const int cols, const size_t pixel_size) {
+                switch (pixel_size) {
+                        case 1 :
+                                return detail::transpose<1>(src_rows, dst_rows, rows, cols);
+                        case 2 :
+                                return detail::transpose<2>(src_rows, dst_rows, rows, cols);
+                        case 3 :
+                                return detail::transpose<3>(src_rows, dst_rows, rows, cols);
+                        case 4 :
+                                return detail::transpose<4>(src_rows, dst_rows, rows, cols);
+                        case 6 :
+                                return detail::transpose<6>(src_rows, dst_rows, rows, cols);
+                        case 8 :
+                                return detail::transpose<8>(src_rows, dst_rows, rows, cols);
+                        default :
+                                for (int c = 0; c < cols; ++c) {
+                                        for (int r = 0; r < rows; ++r) {
+                                                std::memcpy(dst_rows[c] + r * pixel_size, src_rows[r] + c * pixel_size, pixel_size);
+                                        }
+                                }
+                }
+        }
+
+        /**
+         * @brief Transpose pixels of strided images.
+         * @param src_step Bytes between rows of the source.
+         * @param dst_step Bytes between rows of the destination.
+         */
+        inline void transpose(const uint8_t *src, const size_t src_step, uint8_t *dst, const size_t dst_step, const int rows, const int cols, const size_t pixel_size) {
+                std::vector<const uint8_t *> src_rows(static_cast<size_t>(rows));
+                std::vector<uint8_t *> dst_rows(static_cast<size_t>(cols));
+                for (int r = 0; r < rows; ++r) {
+                        src_rows[size_t(r)] = src + size_t(r) * src_step;
+                }
+                for (int c = 0; c < cols; ++c) {
+                        dst_rows[size_t(c)] = dst + size_t(c) * dst_step;
+                }
+                mi::transpose(src_rows.data(), dst_rows.data(), rows, cols, pixel_size);
+        }
+}
+#endif //MI_TRANSPOSE_HPP
@@ -20,11 +20,13 @@
  * SOFTWARE.
 */
 #include <iostream>
+#include <string>
 #include <vector>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/core.hpp>
 
-int main() {
+// usage: make_sample_mtif [filename] [compression (1: none, 5: LZW, ...)]
+int main(int argc, char **argv) {
         try {
                 std::vector<cv::Mat> images;
                 for (int z = 0; z < 256; ++z) {
@@ -35,8 +37,10 @@ int main() {
                                 }
                         }
                 }
-                std::vector<int> params = {cv::IMWRITE_TIFF_COMPRESSION, 1};
-                cv::imwritemulti("mtifsample.tif", images, params);
+                const std::string filename = (argc > 1) ? argv[1] : "mtifsample.tif";
+                const int compression = (argc > 2) ? std::stoi(argv[2]) : 1;
+                std::vector<int> params = {cv::IMWRITE_TIFF_COMPRESSION, compression};
+                cv::imwritemulti(filename, images, params);
         } catch (std::runtime_error &e) {
                 std::cerr << e.what() << std::endl;
         } catch (...) {
@@ -0,0 +1,60 @@
+/**
+ * MIT License
+ * Copyright (c) 2021 RIKEN
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// writes the volume of make_sample as NRRD (sample.nrrd : 8 bit, attached) and (sample16be.nhdr : 16 bit, big endian, detached).
+int main () {
+        try {
+                std::ofstream fout8("sample.nrrd", std::ios::binary);
+                fout8 << "NRRD0004\n# generated by make_sample_nrrd\n" << "type: uchar\ndimension: 4\nsizes: 3 256 256 256\nendian: little\nencoding: raw\n\n";
+                std::ofstream fout16("sample16be.raw", std::ios::binary);
+                std::vector<uint8_t> row8(256 * 3), row16(256 * 3 * 2);
+                for (int z = 0 ; z < 256 ; ++z) {
+                        for (int y = 0 ; y < 256 ; ++y) {
+                                for (int x = 0 ; x < 256; ++x) {
+                                        const uint8_t v[3] = {uint8_t(z), uint8_t(y), uint8_t(x)};
+                                        for (int c = 0 ; c < 3 ; ++c) {
+                                                row8[x * 3 + c] = v[c];
+                                                row16[(x * 3 + c) * 2] = v[c]; // v << 8 in big endian
+                                                row16[(x * 3 + c) * 2 + 1] = 0;
+                                        }
+                                }
+                                fout8.write(reinterpret_cast<const char*>(row8.data()), std::streamsize(row8.size()));
+                                fout16.write(reinterpret_cast<const char*>(row16.data()), std::streamsize(row16.size()));
+                        }
+                }
+                std::ofstream("sample16be.nhdr") << "NRRD0004\n" << "type: ushort\ndimension: 4\nsizes: 3 256 256 256\nendian: big\nencoding: raw\ndata file: sample16be.raw\n";
+                if (!fout8 || !fout16) {
+                        throw std::runtime_error("The volume cannot be created");
+                }
+        } catch (std::runtime_error& e) {
+                std::cerr<<e.what()<<std::endl;
+        } catch (...) {
+                std::cerr<<"Unknown error."<<std::endl;
+        }
+        return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * MIT License
+ * Copyright (c) 2021 RIKEN
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <xyz2zxy.hpp>
+
+// usage: make_volume {output} {sx} {sy} {sz} [depth (8 or 16)] [channels (1 or 3)] [format (png, tif or stack)]
+// writes a synthetic volume for benchmarks. {output} is a directory of slices (png, tif) or a multi-page BigTIFF (stack).
+// Voxels are a mixture of gradients and hashed noise so that compressed formats do not degenerate.
+int main (int argc, char** argv) {
+        try {
+                if (argc < 5) {
+                        throw std::runtime_error("Runtime error. Invalid argument");
+                }
+                const std::filesystem::path output = argv[1];
+                const int sx = std::stoi(argv[2]), sy = std::stoi(argv[3]), sz = std::stoi(argv[4]);
+                const int depth = (argc > 5) ? std::stoi(argv[5]) : 8;
+                const int channels = (argc > 6) ? std::stoi(argv[6]) : 1;
+                const std::string format = (argc > 7) ? argv[7] : "png";
+                if (sx <= 0 || sy <= 0 || sz <= 0) {
+                        throw std::runtime_error("Invalid volume size");
+                } else if (depth != 8 && depth != 16) {
+                        throw std::runtime_error("Invalid depth : " + std::to_string(depth));
+                } else if (channels != 1 && channels != 3) {
+                        throw std::runtime_error("Invalid channels : " + std::to_string(channels));
+                } else if (format != "png" && format != "tif" && format != "stack") {
+                        throw std::runtime_error("Invalid format : " + format);
+                } else if (format == "stack" && output.extension() != ".tif" && output.extension() != ".tiff" && output.extension() != ".btf") {
+                        throw std::runtime_error("The stack must be .tif, .tiff or .btf : " + output.string());
+                }
+                std::vector<int> params;
+                if (format != "png") {
+                        params = {cv::IMWRITE_TIFF_COMPRESSION, 1}; // no compression
+                }
+                std::unique_ptr<xyz2zxy::slice_sink> sink = xyz2zxy::open_sink(output, "." + (format == "png" ? format : std::string("tif")), params);
+                sink->open(uint32_t(sz));
+                const int type = CV_MAKETYPE(depth == 8 ? CV_8U : CV_16U, channels);
+                std::atomic<bool> is_failed{false};
+                mi::thread_pool pool;
+                pool.parallel_for(size_t(sz), [&](const size_t k) {
+                        const uint32_t z = uint32_t(k);
+                        cv::Mat image(cv::Size(sx, sy), type);
+                        for (int y = 0 ; y < sy ; ++y) {
+                                for (int x = 0 ; x < sx * channels; ++x) {
+                                        uint32_t h = (uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ (z * 83492791u);
+                                        h = (h ^ (h >> 13)) * 0x5bd1e995u;
+                                        const uint32_t gradient = uint32_t(x / channels + y) + z;
+                                        if (depth == 8) {
+                                                image.ptr<uint8_t>(y)[x] = uint8_t(gradient + (h >> 28));
+                                        } else {
+                                                image.ptr<uint16_t>(y)[x] = uint16_t((gradient << 6) + (h >> 22));
+                                        }
+                                }
+                        }
+                        if (!sink->write(z, image)) {
+                                is_failed = true;
+                        }
+                });
+                sink->close();
+                if (is_failed) {
+                        throw std::runtime_error(output.string() + " cannot be written.");
+                }
+                std::cerr << output.string() << " : " << sx << "x" << sy << "x" << sz << ", " << depth << " bit, " << channels << " channel(s), " << format << std::endl;
+        } catch (std::exception& e) {
+                std::cerr<<e.what()<<std::endl;
+                return -1;
+        } catch (...) {
+                std::cerr<<"Unknown error."<<std::endl;
+                return -1;
+        }
+        return 0;
+}
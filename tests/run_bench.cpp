@@ -0,0 +1,180 @@
+/**
+ * MIT License
+ * Copyright (c) 2021 RIKEN
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// usage: run_bench {xyz2zxy} {xyz2yzx} {input} [-n {steps}] [-t {threads}] [-c {compressions}] [--mem-limit {size}] [-ext {extension}] [--csv {file}]
+// runs both reslicers for every combination of the comma-separated lists of -n, -t (0 : default of the tools) and -c (default : default of the format),
+// and prints the throughput of each stage in MB/s (the volume size divided by the wall time of the stage)
+// with the compression ratio (the volume size divided by the bytes of the output).
+namespace {
+        struct run_report {
+                std::string mode;
+                uint64_t bytes = 0;
+                uint64_t output_bytes = 0;
+                std::string step, threads;
+                std::vector<std::pair<std::string, double>> stages;
+        };
+
+        std::vector<std::string> split(const std::string &str) {
+                std::vector<std::string> tokens;
+                std::stringstream ss(str);
+                for (std::string token; std::getline(ss, token, ',');) {
+                        if (!token.empty()) {
+                                tokens.emplace_back(token);
+                        }
+                }
+                return tokens;
+        }
+
+        // the raw value of "key": in the JSON written by --report.
+        std::string value_of(const std::string &json, const std::string &key, const size_t from = 0) {
+                const size_t pos = json.find("\"" + key + "\": ", from);
+                if (pos == std::string::npos) {
+                        return "";
+                }
+                const size_t begin = pos + key.size() + 4;
+                const size_t end = json.find_first_of(",}\n", begin);
+                std::string value = json.substr(begin, end - begin);
+                if (value.size() >= 2 && value.front() == '"') {
+                        value = value.substr(1, value.size() - 2);
+                }
+                return value;
+        }
+
+        run_report load_report(const std::filesystem::path &path) {
+                std::ifstream fin(path);
+                if (!fin) {
+                        throw std::runtime_error(path.string() + " was not written. The run failed.");
+                }
+                const std::string json((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+                run_report report;
+                report.mode = value_of(json, "mode");
+                report.bytes = std::stoull(value_of(json, "bytes"));
+                report.output_bytes = std::stoull(value_of(json, "output", json.find("\"bytes_written\"")));
+                report.step = value_of(json, "step");
+                report.threads = value_of(json, "threads");
+                for (size_t pos = json.find("\"name\": ", json.find("\"stages\"")); pos != std::string::npos; pos = json.find("\"name\": ", pos + 1)) {
+                        report.stages.emplace_back(value_of(json, "name", pos), std::stod(value_of(json, "wall_sec", pos)));
+                }
+                return report;
+        }
+}
+
+int main (int argc, char** argv) {
+        try {
+                if (argc < 4) {
+                        throw std::runtime_error("Runtime error. Invalid argument");
+                }
+                std::vector<std::string> steps{"0"}, threads{"0"}, compressions{"default"};
+                std::string mem_limit, extension = ".tif";
+                std::filesystem::path csv;
+                for (int i = 4; i + 1 < argc; i += 2) {
+                        const std::string key = argv[i];
+                        if (key == "-n") {
+                                steps = split(argv[i + 1]);
+                        } else if (key == "-t") {
+                                threads = split(argv[i + 1]);
+                        } else if (key == "-c") {
+                                compressions = split(argv[i + 1]);
+                        } else if (key == "--mem-limit") {
+                                mem_limit = argv[i + 1];
+                        } else if (key == "-ext") {
+                                extension = argv[i + 1];
+                        } else if (key == "--csv") {
+                                csv = argv[i + 1];
+                        } else {
+                                throw std::runtime_error("Unknown option : " + key);
+                        }
+                }
+                const std::filesystem::path output = "bench_output", report_path = "bench_report.json";
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+                const std::string quiet = " 2> NUL";
+#else
+                const std::string quiet = " 2> /dev/null";
+#endif
+                std::ofstream fcsv;
+                if (!csv.empty()) {
+                        fcsv.open(csv);
+                        fcsv << "tool,n,t,compress,mode,step,threads,stage,wall_sec,mb_per_sec,ratio" << std::endl;
+                }
+                std::cout << std::left << std::setw(10) << "tool" << std::setw(6) << "-n" << std::setw(6) << "-t" << std::setw(9) << "-c" << std::setw(13) << "mode" << std::setw(7) << "step"
+                          << std::setw(9) << "threads" << std::setw(11) << "stage" << std::right << std::setw(10) << "sec" << std::setw(10) << "MB/s" << std::setw(8) << "ratio" << std::endl;
+                for (int tool = 1; tool <= 2; ++tool) {
+                        const std::filesystem::path exe = argv[tool];
+                        for (const std::string &n: steps) {
+                                for (const std::string &t: threads) {
+                                        for (const std::string &c: compressions) {
+                                                std::filesystem::remove(report_path);
+                                                std::stringstream cmd;
+                                                cmd << "\"" << exe.string() << "\" -i \"" << argv[3] << "\" -o " << output.string() << " -ext " << extension << " --report " << report_path.string();
+                                                if (n != "0") {
+                                                        cmd << " -n " << n;
+                                                }
+                                                if (t != "0") {
+                                                        cmd << " -t " << t;
+                                                }
+                                                if (!mem_limit.empty()) {
+                                                        cmd << " --mem-limit " << mem_limit;
+                                                }
+                                                if (c != "default") {
+                                                        cmd << " --compress " << c;
+                                                }
+                                                std::system((cmd.str() + quiet).c_str());
+                                                const run_report report = load_report(report_path);
+                                                std::filesystem::remove_all(output);
+                                                const double ratio = (report.output_bytes > 0) ? double(report.bytes) / double(report.output_bytes) : 0;
+                                                std::vector<std::pair<std::string, double>> rows = report.stages;
+                                                double total = 0;
+                                                for (const auto &stage: report.stages) {
+                                                        total += stage.second;
+                                                }
+                                                rows.emplace_back("Total", total);
+                                                for (const auto &[stage, sec]: rows) {
+                                                        const double mb_per_sec = (sec > 0) ? double(report.bytes) / (1024.0 * 1024.0) / sec : 0;
+                                                        std::cout << std::left << std::setw(10) << exe.stem().string() << std::setw(6) << n << std::setw(6) << t << std::setw(9) << c << std::setw(13) << report.mode << std::setw(7) << report.step
+                                                                  << std::setw(9) << report.threads << std::setw(11) << stage << std::right << std::fixed << std::setprecision(3) << std::setw(10) << sec
+                                                                  << std::setprecision(1) << std::setw(10) << mb_per_sec << std::setprecision(2) << std::setw(8) << ratio << std::endl;
+                                                        if (fcsv.is_open()) {
+                                                                fcsv << exe.stem().string() << "," << n << "," << t << "," << c << "," << report.mode << "," << report.step << "," << report.threads << ","
+                                                                     << stage << "," << sec << "," << mb_per_sec << "," << ratio << std::endl;
+                                                        }
+                                                }
+                                        }
+                                }
+                        }
+                }
+                std::filesystem::remove(report_path);
+        } catch (std::exception& e) {
+                std::cerr<<e.what()<<std::endl;
+                return -1;
+        }
+        return 0;
+}
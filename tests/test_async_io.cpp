@@ -0,0 +1,118 @@
+/**
+ * MIT License
+ * Copyright (c) 2021 RIKEN
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <mi/async_io.hpp>
+
+namespace {
+        // files are written and read back by a batch, and requests of missing files fail without blocking the batch or the destructor.
+        void check(const bool is_uring_used, const mi::cache_policy cache) {
+                const std::filesystem::path dir = "async_io_temp";
+                std::filesystem::remove_all(dir);
+                std::filesystem::create_directories(dir);
+                mi::async_io io(4, cache, is_uring_used); // fewer slots than requests
+                const std::string name = io.backend() + " (cache " + std::to_string(int(cache)) + ")";
+                if (!is_uring_used && io.is_ring()) {
+                        throw std::runtime_error(name + " : io_uring is used.");
+                }
+                const size_t num_files = 32;
+                mi::async_io::batch writes(io);
+                for (size_t i = 0; i < num_files; ++i) {
+                        std::vector<uint8_t> data(1000 * i + 1);
+                        for (size_t j = 0; j < data.size(); ++j) {
+                                data[j] = uint8_t(i + j);
+                        }
+                        writes.write(dir / std::to_string(i), std::move(data));
+                }
+                writes.wait();
+                if (io.files_written() != num_files) {
+                        throw std::runtime_error(name + " : the number of files written is different.");
+                }
+                std::vector<std::vector<uint8_t>> buffers;
+                for (size_t i = 0; i < num_files; ++i) {
+                        buffers.emplace_back(1000 * i + 1);
+                }
+                mi::async_io::batch reads(io);
+                for (size_t i = 0; i < num_files; ++i) {
+                        reads.read(dir / std::to_string(i), buffers[i].data(), buffers[i].size());
+                }
+                reads.wait();
+                for (size_t i = 0; i < num_files; ++i) {
+                        for (size_t j = 0; j < buffers[i].size(); ++j) {
+                                if (buffers[i][j] != uint8_t(i + j)) {
+                                        throw std::runtime_error(name + " : " + std::to_string(i) + " is different.");
+                                }
+                        }
+                }
+
+                bool is_failed = false;
+                for (size_t i = 0; i < num_files; ++i) {
+                        writes.write(dir / "missing" / std::to_string(i), std::vector<uint8_t>(100)); // the directory does not exist
+                }
+                try {
+                        writes.wait();
+                } catch (std::runtime_error &) {
+                        is_failed = true;
+                }
+                if (!is_failed || io.files_written() != num_files) {
+                        throw std::runtime_error(name + " : writes to a missing directory did not fail.");
+                }
+                is_failed = false;
+                std::vector<uint8_t> buffer(100);
+                reads.read(dir / "0", buffer.data(), buffer.size()); // shorter than the buffer
+                reads.read(dir / "missing" / "0", buffer.data(), buffer.size());
+                try {
+                        reads.wait();
+                } catch (std::runtime_error &) {
+                        is_failed = true;
+                }
+                if (!is_failed) {
+                        throw std::runtime_error(name + " : reads of a missing file did not fail.");
+                }
+                reads.write(dir / "after_failure", std::vector<uint8_t>(10)); // the batch can be used again
+                reads.wait();
+                if (std::filesystem::file_size(dir / "after_failure") != 10) {
+                        throw std::runtime_error(name + " : the batch was not used again.");
+                }
+        }
+}
+
+// reads and writes of both backends (io_uring if available, and the I/O threads) with and without O_DIRECT.
+int main() {
+        try {
+                for (const bool is_uring_used: {true, false}) {
+                        for (const mi::cache_policy cache: {mi::cache_policy::keep, mi::cache_policy::direct}) {
+                                check(is_uring_used, cache);
+                        }
+                }
+                std::filesystem::remove_all("async_io_temp");
+        } catch (std::runtime_error &e) {
+                std::cerr << e.what() << std::endl;
+                return -1;
+        }
+        std::cerr << "validation ok" << std::endl;
+        return 0;
+}
@@ -0,0 +1,301 @@
+/**
+ * MIT License
+ * Copyright (c) 2021 RIKEN
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <xyz2zxy.hpp>
+
+namespace {
+        const int sx = 96, sy = 64, sz = 40;
+
+        // the voxel (x, y, z) is (z, y, x) in BGR. The plane k of the order "abc" has (row, col) = (b, a) and c = k.
+        // scale : the volume is downsampled by scale.
+        bool is_valid_plane(const std::string &order, const uint32_t k, const cv::Mat &plane, const int scale = 1) {
+                const int size[3] = {sx / scale, sy / scale, sz / scale};
+                const auto axis = [&order](const int i) { return int(order[size_t(i)] - 'x'); };
+                if (plane.cols != size[axis(0)] || plane.rows != size[axis(1)]) {
+                        return false;
+                }
+                for (int row = 0 ; row < plane.rows ; ++row) {
+                        for (int col = 0 ; col < plane.cols ; ++col) {
+                                int p[3]; // x, y, z
+                                p[axis(0)] = col;
+                                p[axis(1)] = row;
+                                p[axis(2)] = int(k);
+                                if (const auto &v = plane.at<cv::Vec3b>(row, col); v[0] != p[2] || v[1] != p[1] || v[2] != p[0]) {
+                                        return false;
+                                }
+                        }
+                }
+                return true;
+        }
+
+        // the Zarr array of the order is read into planes and checked.
+        bool is_valid_zarr(const std::filesystem::path &dir, const std::string &order, const int b) {
+                const int size[3] = {sx, sy, sz};
+                const int cols = size[order[0] - 'x'], rows = size[order[1] - 'x'], planes = size[order[2] - 'x'];
+                std::vector<cv::Mat> volume;
+                for (int k = 0 ; k < planes ; ++k) {
+                        volume.emplace_back(rows, cols, CV_8UC3);
+                }
+                std::vector<uint8_t> block(size_t(b) * b * b * 3);
+                for (int k = 0 ; k < planes ; k += b) {
+                        for (int j = 0 ; j < rows ; j += b) {
+                                for (int i = 0 ; i < cols ; i += b) {
+                                        std::ifstream fin(dir / std::to_string(k / b) / std::to_string(j / b) / std::to_string(i / b) / "0", std::ios::binary);
+                                        std::vector<uint8_t> data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+#if defined(XYZ2ZXY_WITH_ZLIB)
+                                        uLongf bytes = uLongf(block.size());
+                                        if (uncompress(block.data(), &bytes, data.data(), uLong(data.size())) != Z_OK || bytes != block.size()) {
+                                                return false;
+                                        }
+#else
+                                        if (data.size() != block.size()) {
+                                                return false;
+                                        }
+                                        block = data;
+#endif
+                                        for (int z = 0 ; z < b && k + z < planes ; ++z) {
+                                                for (int y = 0 ; y < b && j + y < rows ; ++y) {
+                                                        for (int x = 0 ; x < b && i + x < cols ; ++x) {
+                                                                const uint8_t *v = block.data() + ((size_t(z) * b + y) * b + x) * 3;
+                                                                volume[size_t(k + z)].at<cv::Vec3b>(j + y, i + x) = cv::Vec3b(v[0], v[1], v[2]);
+                                                        }
+                                                }
+                                        }
+                                }
+                        }
+                }
+                for (int k = 0 ; k < planes ; ++k) {
+                        if (!is_valid_plane(order, uint32_t(k), volume[size_t(k)])) {
+                                return false;
+                        }
+                }
+                return std::filesystem::exists(dir / ".zarray");
+        }
+
+        // a sink stopping the conversion at a plane, as if the process were killed.
+        class interrupted_sink : public xyz2zxy::files_sink {
+        public:
+                using xyz2zxy::files_sink::files_sink;
+
+                bool write(const uint32_t u, const cv::Mat &image) override {
+                        if (u == 20) {
+                                throw std::runtime_error("interrupted");
+                        }
+                        return xyz2zxy::files_sink::write(u, image);
+                }
+        };
+}
+
+// converts a non-cubic volume on the memory in all orders and checks the planes passed to the callback.
+// A rejected plane and a slice of another type fail the run. Then a conversion interrupted in Step2 is resumed, and a pyramid of a volume made of 2x2x2 blocks is checked.
+int main () {
+        try {
+                std::vector<cv::Mat> images, blocks;
+                for (int z = 0 ; z < sz ; ++z) {
+                        images.emplace_back(cv::Size(sx, sy), CV_8UC3);
+                        blocks.emplace_back(cv::Size(sx, sy), CV_8UC3);
+                        for (int y = 0 ; y < sy ; ++y) {
+                                for (int x = 0 ; x < sx; ++x) {
+                                        images[size_t(z)].at<cv::Vec3b>(y, x) = cv::Vec3b(uint8_t(z), uint8_t(y), uint8_t(x));
+                                        blocks[size_t(z)].at<cv::Vec3b>(y, x) = cv::Vec3b(uint8_t(z / 2), uint8_t(y / 2), uint8_t(x / 2));
+                                }
+                        }
+                }
+                for (const std::string order : {"xyz", "xzy", "yxz", "yzx", "zxy", "zyx"}) {
+                        for (const size_t mem_limit : {size_t(0), size_t(1) << 18}) { // in-memory and out-of-core
+                                xyz2zxy::options opt;
+                                opt.order = order;
+                                opt.mem_limit = mem_limit;
+                                opt.tmp_dir = "reslicer_temp";
+                                opt.is_verbose = false;
+                                const int size[3] = {sx, sy, sz};
+                                std::atomic<uint32_t> planes(0);
+                                xyz2zxy::Reslicer(opt).setInput(images).setOutput([&](const uint32_t k, const cv::Mat &plane) {
+                                        if (!is_valid_plane(order, k, plane)) {
+                                                return false;
+                                        }
+                                        ++planes;
+                                        return true;
+                                }).run();
+                                if (int(planes) != size[order[2] - 'x']) {
+                                        throw std::runtime_error(order + " : the number of planes is different.");
+                                }
+                        }
+                }
+
+                for (const size_t mem_limit : {size_t(0), size_t(1) << 18}) { // a plane rejected by the output fails the run, and the scratch is left
+                        xyz2zxy::options opt;
+                        opt.mem_limit = mem_limit;
+                        opt.tmp_dir = "rejected_temp";
+                        opt.is_verbose = false;
+                        std::filesystem::remove_all(opt.tmp_dir);
+                        bool is_failed = false;
+                        try {
+                                xyz2zxy::Reslicer(opt).setInput(images).setOutput([](const uint32_t k, const cv::Mat &) { return k != 5; }).run();
+                        } catch (std::runtime_error &) {
+                                is_failed = true;
+                        }
+                        if (!is_failed || std::filesystem::exists(opt.tmp_dir) != (mem_limit > 0)) {
+                                throw std::runtime_error("rejected plane : the failure was not reported.");
+                        }
+                        std::filesystem::remove_all(opt.tmp_dir);
+                }
+
+                for (const size_t mem_limit : {size_t(0), size_t(1) << 18}) { // a slice of another type fails the run
+                        std::vector<cv::Mat> mixed = images;
+                        mixed[30].convertTo(mixed[30], CV_16UC3);
+                        xyz2zxy::options opt;
+                        opt.mem_limit = mem_limit;
+                        opt.tmp_dir = "mixed_temp";
+                        opt.is_verbose = false;
+                        bool is_failed = false;
+                        try {
+                                xyz2zxy::Reslicer(opt).setInput(mixed).setOutput([](const uint32_t, const cv::Mat &) { return true; }).run();
+                        } catch (std::runtime_error &) {
+                                is_failed = true;
+                        }
+                        if (!is_failed) {
+                                throw std::runtime_error("mixed slices : the failure was not reported.");
+                        }
+                        std::filesystem::remove_all(opt.tmp_dir);
+                }
+
+                xyz2zxy::options opt;
+                opt.order = "zxy";
+                opt.mem_limit = size_t(1) << 18;
+                opt.step = 8;
+                opt.tmp_dir = "resume_temp";
+                opt.is_verbose = false;
+                bool is_interrupted = false;
+                try {
+                        xyz2zxy::Reslicer(opt).setInput(images).setOutput(std::make_unique<interrupted_sink>("resume_output", ".png", std::vector<int>())).run();
+                } catch (std::runtime_error &) {
+                        is_interrupted = true; // the temporary directory is left
+                }
+                if (!is_interrupted || !std::filesystem::exists("resume_temp/checkpoint.txt")) {
+                        throw std::runtime_error("resume : the conversion was not interrupted.");
+                }
+                opt.is_resumed = true;
+                xyz2zxy::Reslicer reslicer(opt);
+                reslicer.setInput(images).setOutput(std::make_unique<xyz2zxy::files_sink>("resume_output", ".png", std::vector<int>())).run();
+                if (reslicer.getStatistics().resumed_chunks != sz / 8 || reslicer.getStatistics().resumed_planes != sy - 1) {
+                        throw std::runtime_error("resume : finished work was not skipped.");
+                }
+                if (reslicer.getStatistics().scratch_files != 0) { // brick.raw, manifest.txt and checkpoint.txt are reused
+                        throw std::runtime_error("resume : temporary files were created again.");
+                }
+                for (uint32_t k = 0 ; k < uint32_t(sy) ; ++k) {
+                        const std::string filename = xyz2zxy::files_sink("resume_output", ".png", std::vector<int>()).filename(k);
+                        if (!is_valid_plane(opt.order, k, cv::imread(filename))) {
+                                throw std::runtime_error("resume : " + filename + " is different.");
+                        }
+                }
+
+                for (const std::string order : {"zxy", "yzx"}) { // strips of rows and columns
+                        opt = xyz2zxy::options();
+                        opt.order = order;
+                        opt.mem_limit = size_t(1) << 18;
+                        opt.step = 2;
+                        opt.scratch = "files";
+                        opt.merge = 3; // 20 strips of a plane are merged into 7 and 3
+                        opt.tmp_dir = "merge_temp";
+                        opt.is_verbose = false;
+                        std::atomic<uint32_t> planes(0);
+                        xyz2zxy::Reslicer reslicer(opt);
+                        reslicer.setInput(images).setOutput([&](const uint32_t k, const cv::Mat &plane) {
+                                if (!is_valid_plane(order, k, plane)) {
+                                        return false;
+                                }
+                                ++planes;
+                                return true;
+                        }).run();
+                        const int size[3] = {sx, sy, sz};
+                        if (int(planes) != size[order[2] - 'x'] || reslicer.getStatistics().merge_levels != 2) {
+                                throw std::runtime_error(order + " : the strips were not merged.");
+                        }
+                }
+
+                { // strips written to a scratch whose directory is lost fail instead of blocking the flush.
+                        const xyz2zxy::strip_manifest manifest{"zxy", "files", CV_8UC3, sx, sy, sz, 8};
+                        xyz2zxy::files_scratch storage("failed_temp", manifest);
+                        std::filesystem::remove_all("failed_temp");
+                        for (uint32_t u = 0 ; u < uint32_t(sy) ; ++u) {
+                                storage.write(u, 0, cv::Mat(8, sx, CV_8UC3));
+                        }
+                        bool is_failed = false;
+                        try {
+                                storage.flush();
+                        } catch (std::runtime_error &) {
+                                is_failed = true;
+                        }
+                        if (!is_failed) {
+                                throw std::runtime_error("scratch : the failed writes were not reported.");
+                        }
+                }
+
+                for (const size_t mem_limit : {size_t(0), size_t(1) << 18}) {
+                        opt = xyz2zxy::options();
+                        opt.order = "zxy";
+                        opt.mem_limit = mem_limit;
+                        opt.tmp_dir = "pyramid_temp";
+                        opt.is_verbose = false;
+                        std::atomic<uint32_t> planes(0);
+                        std::vector<std::unique_ptr<xyz2zxy::slice_sink>> levels;
+                        levels.emplace_back(std::make_unique<xyz2zxy::callback_sink>([&](const uint32_t k, const cv::Mat &plane) {
+                                if (!is_valid_plane(opt.order, k, plane, 2)) {
+                                        return false;
+                                }
+                                ++planes;
+                                return true;
+                        }));
+                        auto base = std::make_unique<xyz2zxy::callback_sink>([](const uint32_t, const cv::Mat &) { return true; });
+                        xyz2zxy::Reslicer(opt).setInput(blocks).setOutput(std::make_unique<xyz2zxy::pyramid_sink>(std::move(base), std::move(levels))).run();
+                        if (planes != sy / 2) {
+                                throw std::runtime_error("pyramid : the number of planes is different.");
+                        }
+                }
+
+                for (const std::string order : {"xyz", "yzx", "zxy", "zyx"}) {
+                        for (const size_t mem_limit : {size_t(0), size_t(1) << 18}) { // slabs and row bands of slabs
+                                opt = xyz2zxy::options();
+                                opt.order = order;
+                                opt.mem_limit = mem_limit;
+                                opt.block = 16;
+                                opt.is_verbose = false;
+                                const std::filesystem::path dir = "reslicer_" + order + ".zarr";
+                                std::filesystem::remove_all(dir);
+                                xyz2zxy::Reslicer(opt).setInput(images).setOutput(dir).run();
+                                if (!is_valid_zarr(dir, order, opt.block)) {
+                                        throw std::runtime_error(order + " : the chunked output is different.");
+                                }
+                        }
+                }
+        } catch (std::runtime_error& e) {
+                std::cerr<<e.what()<<std::endl;
+                return -1;
+        }
+        std::cerr<<"validation ok"<<std::endl;
+        return 0;
+}
@@ -42,10 +42,20 @@ int main (int argc, char** argv) {
                         throw std::runtime_error("Runtime error. Invalid argument "+std::string(argv[1]));
                 }
                 std::vector<std::filesystem::path> paths;
-                std::copy(std::filesystem::directory_iterator(argv[1]), std::filesystem::directory_iterator(), std::back_inserter(paths));
-                std::sort(paths.begin(), paths.end());
+                std::vector<cv::Mat> pages; // output written as a single (Big)TIFF
+                if (std::filesystem::is_directory(argv[1])) {
+                        std::copy(std::filesystem::directory_iterator(argv[1]), std::filesystem::directory_iterator(), std::back_inserter(paths));
+                        std::sort(paths.begin(), paths.end());
+                } else if (cv::imreadmulti(argv[1], pages, cv::IMREAD_COLOR)) {
+                        for (size_t i = 0; i < pages.size(); ++i) {
+                                paths.emplace_back(std::string(argv[1]) + " (page " + std::to_string(i) + ")");
+                        }
+                }
+                if (paths.size() < 256) {
+                        throw std::runtime_error("Too few images.");
+                }
                 for (int z = 0 ;z< 256 ; ++z) {
-                        if ( cv::Mat image = cv::imread(paths[z].string()) ; image.empty() ) {
+                        if ( cv::Mat image = pages.empty() ? cv::imread(paths[z].string()) : pages[z] ; image.empty() ) {
                                 throw std::runtime_error(paths[z].string()+ " was empty.");
                         } else if (image.size().width != 256 || image.size().height != 256) {
                                 throw std::runtime_error(" Size different.");
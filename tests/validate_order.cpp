@@ -0,0 +1,88 @@
+// Created by Takashi Michikawa.
+/**
+ * MIT License
+ * Copyright (c) 2021 RIKEN
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/imgcodecs.hpp>
+
+// usage: validate_order {output} {order} [x0 y0 z0 w h d]
+// The voxel (x, y, z) of the sample is (z, y, x) in BGR. The plane k of the order "abc" has (row, col) = (b, a) and c = k.
+// With the region of interest, the voxel (x, y, z) of the output is (x0 + x, y0 + y, z0 + z) of the sample.
+int main (int argc, char** argv) {
+        try {
+                if (argc < 3) {
+                        throw std::runtime_error("Runtime error. Invalid argument");
+                }
+                const std::string order = argv[2];
+                if (std::string sorted = order; std::sort(sorted.begin(), sorted.end()), sorted != "xyz") {
+                        throw std::runtime_error("Invalid order : " + order);
+                }
+                int origin[3] = {0, 0, 0}, size[3] = {256, 256, 256};
+                if (argc >= 9) {
+                        for (int i = 0 ; i < 3 ; ++i) {
+                                origin[i] = std::stoi(argv[3 + i]);
+                                size[i] = std::stoi(argv[6 + i]);
+                        }
+                }
+                std::vector<std::filesystem::path> paths;
+                std::vector<cv::Mat> pages;
+                if (std::filesystem::is_directory(argv[1])) {
+                        std::copy(std::filesystem::directory_iterator(argv[1]), std::filesystem::directory_iterator(), std::back_inserter(paths));
+                        std::sort(paths.begin(), paths.end());
+                } else if (cv::imreadmulti(argv[1], pages, cv::IMREAD_COLOR)) {
+                        for (size_t i = 0; i < pages.size(); ++i) {
+                                paths.emplace_back(std::string(argv[1]) + " (page " + std::to_string(i) + ")");
+                        }
+                }
+                const auto axis = [&order](const int i) { return int(order[size_t(i)] - 'x'); };
+                if (paths.size() != size_t(size[axis(2)])) {
+                        throw std::runtime_error("The number of images is different.");
+                }
+                for (int k = 0 ; k < size[axis(2)] ; ++k) {
+                        const cv::Mat image = pages.empty() ? cv::imread(paths[size_t(k)].string()) : pages[size_t(k)];
+                        if (image.empty()) {
+                                throw std::runtime_error(paths[size_t(k)].string() + " was empty.");
+                        } else if (image.size().width != size[axis(0)] || image.size().height != size[axis(1)]) {
+                                throw std::runtime_error(" Size different.");
+                        }
+                        for (int row = 0 ; row < image.rows ; ++row) {
+                                for (int col = 0 ; col < image.cols ; ++col) {
+                                        int p[3]; // x, y, z
+                                        p[axis(0)] = origin[axis(0)] + col;
+                                        p[axis(1)] = origin[axis(1)] + row;
+                                        p[axis(2)] = origin[axis(2)] + k;
+                                        if (const auto &v = image.at<cv::Vec3b>(row, col); v[0] != p[2] || v[1] != p[1] || v[2] != p[0]) {
+                                                throw std::runtime_error("pixel color different : " + paths[size_t(k)].string());
+                                        }
+                                }
+                        }
+                }
+        } catch (std::runtime_error& e) {
+                std::cerr<<e.what()<<std::endl;
+                return -1;
+        }
+        std::cerr<<"validation ok"<<std::endl;
+        return 0;
+}
@@ -6,9 +6,26 @@
 #define XYZ2ZXY_XYZ2ZXY_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <sstream>
 #include <thread>
@@ -19,23 +36,27 @@
 
 //#include <fmt/core.h>
 
-#include <mi/thread_safe_counter.hpp>
-#include <mi/repeat.hpp>
+#include <mi/thread_pool.hpp>
+#include <mi/async_io.hpp>
 #include <mi/Attribute.hpp>
 #include <mi/peak_memory_size.hpp>
+#include <mi/available_memory_size.hpp>
+#include <mi/mapped_file.hpp>
+#include <mi/page_cache.hpp>
+#include <mi/progress_tracker.hpp>
+#include <mi/json_string.hpp>
+#include <mi/transpose.hpp>
+#include <mi/box_filter.hpp>
+#include <mi/tiff.hpp>
+
+#if defined(XYZ2ZXY_WITH_ZLIB)
+#include <zlib.h>
+#endif
 
 #include <xyz2zxy_version.hpp>
 
 namespace xyz2zxy {
 
-        template<typename T>
-        inline auto progress_bar(std::mutex &mtx, const T v, const T max_value, const std::string header = "progress",
-                                 const int num_dots = 20) {
-                std::lock_guard<std::mutex> lock(mtx);
-                std::cerr << "\033[G" << header << ":[" << std::left << std::setw(num_dots) << std::string(uint32_t(v * T(num_dots) / max_value), '*') << "] (" << v << "/" << max_value << ")" << std::flush;
-                //std::cerr << fmt::format("\r{0}:[{1:-<{2}}] ({4:{3}d}/{5})", header, std::string(uint32_t(v * T(num_dots) / max_value), '*'), num_dots,std::to_string(max_value).length(), v, max_value);
-        }
-
         void create_directory(const std::filesystem::path &path) {
                 std::filesystem::create_directories(path);
                 if (!std::filesystem::exists(path) || !std::filesystem::is_directory(path)) {
@@ -43,34 +64,755 @@ namespace xyz2zxy {
                 }
         }
 
-        bool write_image(const std::string &filename, const cv::Mat &image, std::vector<int> &params) {
+        bool write_image(const std::string &filename, const cv::Mat &image, const std::vector<int> &params) {
                 if (image.depth() <= 2) {
-                        cv::imwrite(filename, image, params);
-                        return true;
+                        return cv::imwrite(filename, image, params);
                 } else {
                         std::cerr << "Unsupported depth:" << image.depth() << std::endl;
                         return false;
                 }
         }
 
-        void init_arguments(
-                const std::string &cmd,
-                mi::Argument &arg,
-                std::filesystem::path &input_dir,
-                std::filesystem::path &outputDir,
-                int &step,
-                std::filesystem::path &extension,
-                std::vector<int> &params) {
+        /**
+         * @brief Geometry of the temporary strips.
+         */
+        struct strip_manifest {
+                std::string order = "zxy"; ///< axis order of the output. Strips are stacked vertically (slice axis y) or horizontally (slice axis x).
+                std::string scratch = "brick"; ///< brick or files.
+                int type = 0;
+                uint32_t sx = 0, sy = 0, sz = 0;
+                uint32_t step = 0;
+
+                void save(const std::filesystem::path &filename) const {
+                        std::ofstream fout(filename);
+                        fout << "order " << this->order << "\n" << "scratch " << this->scratch << "\n" << "type " << this->type << "\n"
+                             << "size " << this->sx << " " << this->sy << " " << this->sz << "\n" << "step " << this->step << std::endl;
+                        if (!fout) {
+                                throw std::runtime_error(filename.string() + " cannot be written.");
+                        }
+                }
+
+                void load(const std::filesystem::path &filename) {
+                        std::ifstream fin(filename);
+                        std::string key;
+                        fin >> key >> this->order >> key >> this->scratch >> key >> this->type >> key >> this->sx >> this->sy >> this->sz >> key >> this->step;
+                        if (!fin) {
+                                throw std::runtime_error(filename.string() + " cannot be read.");
+                        }
+                }
+
+                [[nodiscard]] bool is_horizontal() const {
+                        return !this->order.empty() && this->order.back() == 'x';
+                }
+
+                /// whether the strips of that manifest can be reused (the step may differ).
+                [[nodiscard]] bool is_same_volume(const strip_manifest &that) const {
+                        return this->order == that.order && this->scratch == that.scratch && this->type == that.type && this->sx == that.sx && this->sy == that.sy && this->sz == that.sz;
+                }
+
+                /// the number of planes in the scratch.
+                [[nodiscard]] uint32_t planes() const {
+                        return this->is_horizontal() ? this->sx : this->sy;
+                }
+
+                /// size of a plane before mirroring and rotation.
+                [[nodiscard]] cv::Size plane_size() const {
+                        return this->is_horizontal() ? cv::Size(int(this->sz), int(this->sy)) : cv::Size(int(this->sx), int(this->sz));
+                }
+
+                /// slices stored in the strip beginning at z.
+                [[nodiscard]] cv::Range strip_range(const uint32_t z) const {
+                        return cv::Range(int(z), int(std::min(z + this->step, this->sz)));
+                }
+
+                /// size of the strip beginning at z.
+                [[nodiscard]] cv::Size strip_size(const uint32_t z) const {
+                        const int n = this->strip_range(z).size();
+                        return this->is_horizontal() ? cv::Size(n, int(this->sy)) : cv::Size(int(this->sx), n);
+                }
+        };
+
+        /**
+         * @brief Storage of the strips between Step1 and Step2.
+         * @note Strips of a plane are stacked along z. write() is called concurrently for different strips.
+         */
+        class scratch {
+        protected:
+                strip_manifest manifest_;
+
+                /// the region of the strip beginning at z in the plane (or in the part of the plane beginning at the slice origin).
+                [[nodiscard]] cv::Mat strip(cv::Mat &plane, const uint32_t z, const uint32_t origin = 0) const {
+                        const cv::Range range = this->manifest_.strip_range(z) - int(origin);
+                        return this->manifest_.is_horizontal() ? plane.colRange(range) : plane.rowRange(range);
+                }
+
+        public:
+                explicit scratch(const strip_manifest &manifest) : manifest_(manifest) {}
+
+                scratch(const scratch &that) = delete;
+
+                scratch &operator=(const scratch &that) = delete;
+
+                virtual ~scratch() = default;
+
+                /**
+                 * @brief Store a strip.
+                 * @param u Plane index.
+                 * @param z The first slice of the strip.
+                 */
+                virtual void write(const uint32_t u, const uint32_t z, const cv::Mat &strip) = 0;
+
+                /**
+                 * @brief Get the plane built from all strips.
+                 * @note The returned image may refer the scratch. Do not modify it.
+                 * @throw runtime_error if a strip cannot be read.
+                 */
+                virtual cv::Mat read(const uint32_t u) = 0;
+
+                /**
+                 * @brief Wait until the strips written so far are stored.
+                 * @throw runtime_error if a strip cannot be written.
+                 */
+                virtual void flush() {}
+
+                /**
+                 * @brief Called when the plane u is not read any more, so that its pages can be dropped from the page cache.
+                 */
+                virtual void release([[maybe_unused]] uint32_t u) {}
+
+                /// the number of files created by the scratch.
+                [[nodiscard]] virtual uint64_t files_created() const {
+                        return 0;
+                }
+
+                /// the way of I/O (mmap, io_uring or threads).
+                [[nodiscard]] virtual std::string io() const {
+                        return "mmap";
+                }
+        };
+
+        /**
+         * @brief Scratch of raw files (tmpDir/<z>/image-<u>.raw).
+         * @note A file holds the rows of a strip without header, i.e., width * rows * elemSize() bytes. The type and the size are stored in strip_manifest.
+         * Files are written and read asynchronously, so that many strips are in flight at once instead of each worker waiting for its file.
+         * The strips of a plane are read together.
+         */
+        class files_scratch : public scratch {
+        private:
+                std::filesystem::path dir_;
+                mi::async_io io_;
+                mi::async_io::batch writes_; ///< strips written since the last flush()
+
+                [[nodiscard]] std::string filename(const uint32_t u, const uint32_t z) const {
+                        std::stringstream ss;
+                        ss << this->dir_.string() << "/" << z << "/" << "image-" << std::setw(5) << std::setfill('0') << u << ".raw";
+                        return ss.str();
+                        //return fmt::format("{}/{}/image-{:05d}.raw", this->dir_.string(), z, u);
+                }
+
+                // submit the read of the strip of the plane u beginning at z into roi. Strips not contiguous in roi are read into copies.
+                void read(const uint32_t u, const uint32_t z, const cv::Mat &roi, mi::async_io::batch &reads, std::vector<std::pair<cv::Mat, cv::Mat>> &copies) {
+                        if (!roi.isContinuous()) {
+                                copies.emplace_back(cv::Mat(roi.size(), roi.type()), roi);
+                        }
+                        const cv::Mat &buffer = roi.isContinuous() ? roi : copies.back().first;
+                        reads.read(this->filename(u, z), buffer.data, buffer.total() * buffer.elemSize());
+                }
+
+        public:
+                /**
+                 * @param cache Use of the page cache. Strips read are dropped from the cache (drop), or the cache is bypassed (direct).
+                 */
+                files_scratch(const std::filesystem::path &dir, const strip_manifest &manifest, const mi::cache_policy cache = mi::cache_policy::keep)
+                        : scratch(manifest), dir_(dir), io_(64, cache), writes_(io_) {
+                        for (uint32_t z = 0; z < manifest.sz; z += manifest.step) {
+                                xyz2zxy::create_directory(dir / std::to_string(z));
+                        }
+                }
+
+                void write(const uint32_t u, const uint32_t z, const cv::Mat &strip) override {
+                        const size_t row_size = strip.cols * strip.elemSize();
+                        std::vector<uint8_t> data(row_size * strip.rows);
+                        for (int y = 0; y < strip.rows; ++y) {
+                                std::memcpy(data.data() + row_size * y, strip.ptr(y), row_size);
+                        }
+                        this->writes_.write(this->filename(u, z), std::move(data));
+                }
+
+                cv::Mat read(const uint32_t u) override {
+                        cv::Mat plane(this->manifest_.plane_size(), this->manifest_.type);
+                        std::vector<std::pair<cv::Mat, cv::Mat>> copies; // strips not contiguous in the plane and their regions
+                        mi::async_io::batch reads(this->io_);
+                        for (uint32_t z = 0; z < this->manifest_.sz; z += this->manifest_.step) {
+                                this->read(u, z, this->strip(plane, z), reads, copies);
+                        }
+                        reads.wait();
+                        for (auto &[buffer, roi]: copies) {
+                                buffer.copyTo(roi);
+                        }
+                        return plane;
+                }
+
+                /**
+                 * @brief Merge the strips of the planes [u0, u1) beginning in [z, z + that.step) into the strips of that at z.
+                 * @note The strips are read directory by directory in the order of the planes, i.e., in the order they were written.
+                 * @return Bytes read.
+                 */
+                size_t merge(files_scratch &that, const uint32_t z, const uint32_t u0, const uint32_t u1) {
+                        const uint32_t z1 = std::min(z + that.manifest_.step, this->manifest_.sz);
+                        std::vector<cv::Mat> merged;
+                        for (uint32_t u = u0; u < u1; ++u) {
+                                merged.emplace_back(that.manifest_.strip_size(z), this->manifest_.type);
+                        }
+                        std::vector<std::pair<cv::Mat, cv::Mat>> copies;
+                        mi::async_io::batch reads(this->io_);
+                        for (uint32_t s = z; s < z1; s += this->manifest_.step) {
+                                for (uint32_t u = u0; u < u1; ++u) {
+                                        this->read(u, s, this->strip(merged[u - u0], s, z), reads, copies);
+                                }
+                        }
+                        reads.wait();
+                        for (auto &[buffer, roi]: copies) {
+                                buffer.copyTo(roi);
+                        }
+                        size_t bytes = 0;
+                        for (uint32_t u = u0; u < u1; ++u) {
+                                that.write(u, z, merged[u - u0]);
+                                bytes += merged[u - u0].total() * merged[u - u0].elemSize();
+                        }
+                        return bytes;
+                }
+
+                /**
+                 * @brief Remove the strips.
+                 */
+                void remove() {
+                        for (uint32_t z = 0; z < this->manifest_.sz; z += this->manifest_.step) {
+                                std::filesystem::remove_all(this->dir_ / std::to_string(z));
+                        }
+                }
+
+                void flush() override {
+                        this->writes_.wait();
+                }
+
+                [[nodiscard]] uint64_t files_created() const override {
+                        return this->io_.files_written();
+                }
+
+                [[nodiscard]] std::string io() const override {
+                        return this->io_.backend();
+                }
+        };
+
+        /**
+         * @brief Scratch of a single memory-mapped file (tmpDir/brick.raw).
+         * @note Planes are stored contiguously, so that Step2 reads a sequential run of bytes for each plane.
+         */
+        class brick_scratch : public scratch {
+        private:
+                size_t plane_bytes_;
+                uint64_t files_; ///< 1 if brick.raw is created, 0 if it is reused
+                mi::mapped_file file_;
+                mi::cache_policy cache_;
+
+        public:
+                /**
+                 * @param cache Use of the page cache. Except for keep, the writeback is started at each flush() and planes released are dropped from the cache.
+                 * The mapping always goes through the cache, so that direct is the same as drop.
+                 */
+                brick_scratch(const std::filesystem::path &dir, const strip_manifest &manifest, const bool is_created, const mi::cache_policy cache = mi::cache_policy::keep) : scratch(manifest),
+                        plane_bytes_(size_t(manifest.plane_size().area()) * CV_ELEM_SIZE(manifest.type)), files_(is_created && !std::filesystem::exists(dir / "brick.raw") ? 1 : 0),
+                        file_(dir / "brick.raw", is_created ? this->plane_bytes_ * manifest.planes() : 0), cache_(cache) {
+                        if (this->file_.size() < this->plane_bytes_ * manifest.planes()) {
+                                throw std::runtime_error((dir / "brick.raw").string() + " is too small.");
+                        }
+                }
+
+                void write(const uint32_t u, const uint32_t z, const cv::Mat &strip) override {
+                        cv::Mat plane = this->plane(u);
+                        cv::Mat roi = this->strip(plane, z);
+                        strip.copyTo(roi);
+                }
+
+                cv::Mat read(const uint32_t u) override {
+                        return this->plane(u);
+                }
+
+                void flush() override {
+                        if (this->cache_ != mi::cache_policy::keep) {
+                                this->file_.write_back(); // written steadily instead of in bursts of the kernel
+                        }
+                }
+
+                void release(const uint32_t u) override {
+                        if (this->cache_ != mi::cache_policy::keep) {
+                                this->file_.drop(this->file_.data() + this->plane_bytes_ * u, this->plane_bytes_);
+                        }
+                }
+
+                [[nodiscard]] uint64_t files_created() const override {
+                        return this->files_;
+                }
+
+        private:
+                [[nodiscard]] cv::Mat plane(const uint32_t u) const {
+                        return cv::Mat(this->manifest_.plane_size(), this->manifest_.type, this->file_.data() + this->plane_bytes_ * u);
+                }
+        };
+
+        /**
+         * @brief Create the scratch in the directory.
+         * @param is_created true for Step1 (the storage is allocated), false for Step2.
+         * @param cache Use of the page cache.
+         */
+        inline std::unique_ptr<scratch> open_scratch(const std::filesystem::path &dir, const strip_manifest &manifest, const bool is_created, const mi::cache_policy cache = mi::cache_policy::keep) {
+                if (manifest.scratch == "brick") {
+                        return std::make_unique<brick_scratch>(dir, manifest, is_created, cache);
+                } else if (manifest.scratch == "files") {
+                        return std::make_unique<files_scratch>(dir, manifest, cache);
+                } else {
+                        throw std::runtime_error("Unknown scratch : " + manifest.scratch);
+                }
+        }
+
+        /**
+         * @brief Journal of the finished work (tmpDir/checkpoint.txt).
+         * @note A line is appended and flushed when a Step1 chunk, a merge level of the strips or an output plane is finished.
+         * The journal and the data written before each line (including the pages of brick.raw) survive the death of the process, but not a power failure.
+         */
+        class checkpoint {
+        private:
+                std::ofstream out_;
+                std::set<uint32_t> chunks_; ///< the first slices of the finished chunks
+                std::map<uint32_t, uint64_t> planes_; ///< file sizes of the finished planes
+                uint32_t merged_step_ = 0; ///< step of the strips merged last. 0 : not merged
+                mutable std::mutex mtx_;
+        public:
+                /**
+                 * @param is_resumed Load the journal of the previous run. Otherwise the journal is cleared.
+                 * @throw runtime_error if the file cannot be opened.
+                 */
+                checkpoint(const std::filesystem::path &filename, const bool is_resumed) {
+                        if (std::ifstream fin(filename); is_resumed && fin) {
+                                // a line being written when the process died has no newline and is ignored.
+                                for (std::string line; std::getline(fin, line) && !fin.eof();) {
+                                        std::stringstream ss(line);
+                                        std::string key;
+                                        uint32_t i;
+                                        uint64_t bytes;
+                                        if (!(ss >> key >> i)) {
+                                                continue;
+                                        } else if (key == "chunk") {
+                                                this->chunks_.insert(i);
+                                        } else if (key == "merge") {
+                                                this->merged_step_ = std::max(this->merged_step_, i);
+                                        } else if (key == "plane" && ss >> bytes) {
+                                                this->planes_[i] = bytes;
+                                        }
+                                }
+                        }
+                        this->out_.open(filename, is_resumed ? std::ios::app : std::ios::trunc);
+                        if (!this->out_) {
+                                throw std::runtime_error(filename.string() + " cannot be opened.");
+                        }
+                }
+
+                [[nodiscard]] bool has_chunk(const uint32_t z) const {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        return this->chunks_.count(z) > 0;
+                }
+
+                /**
+                 * @brief Whether the plane u was finished and its file still has the recorded size.
+                 * @param bytes Current file size of the plane (0 : not written).
+                 */
+                [[nodiscard]] bool has_plane(const uint32_t u, const uint64_t bytes) const {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        auto it = this->planes_.find(u);
+                        return bytes > 0 && it != this->planes_.end() && it->second == bytes;
+                }
+
+                [[nodiscard]] uint32_t merged_step() const {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        return this->merged_step_;
+                }
+
+                [[nodiscard]] size_t chunks() const {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        return this->chunks_.size();
+                }
+
+                [[nodiscard]] size_t planes() const {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        return this->planes_.size();
+                }
+
+                void add_chunk(const uint32_t z) {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        this->out_ << "chunk " << z << "\n" << std::flush;
+                        this->chunks_.insert(z);
+                }
+
+                void add_merge(const uint32_t step) {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        this->out_ << "merge " << step << "\n" << std::flush;
+                        this->merged_step_ = std::max(this->merged_step_, step);
+                }
+
+                void add_plane(const uint32_t u, const uint64_t bytes) {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        this->out_ << "plane " << u << " " << bytes << "\n" << std::flush;
+                        this->planes_[u] = bytes;
+                }
+        };
+
+        /**
+         * @brief Default memory budget.
+         * @return 80% of the available physical memory.
+         */
+        inline size_t memory_budget() {
+                return mi::available_memory_size() / 5 * 4;
+        }
+
+        /**
+         * @brief Transpose the image in a single cache-blocked pass.
+         * @note Same as cv::flip(src, dst, 0) followed by cv::rotate(dst, dst, cv::ROTATE_90_CLOCKWISE).
+         */
+        inline void transpose(const cv::Mat &src, cv::Mat &dst) {
+                dst.create(src.cols, src.rows, src.type());
+                mi::transpose(src.ptr(), src.step, dst.ptr(), dst.step, src.rows, src.cols, src.elemSize());
+        }
+
+        /**
+         * @brief Build a xyz2zxy plane from the row y of all slices, i.e., dst(x, z) = images[z](y, x).
+         */
+        inline void gather_rows(const std::vector<cv::Mat> &images, const int y, cv::Mat &dst) {
+                dst.create(images[0].cols, int(images.size()), images[0].type());
+                std::vector<const uint8_t *> src_rows;
+                std::vector<uint8_t *> dst_rows;
+                std::transform(images.begin(), images.end(), std::back_inserter(src_rows), [&y](auto &image) { return image.ptr(y); });
+                for (int x = 0; x < dst.rows; ++x) {
+                        dst_rows.push_back(dst.ptr(x));
+                }
+                mi::transpose(src_rows.data(), dst_rows.data(), dst.cols, dst.rows, dst.elemSize());
+        }
+
+        /**
+         * @brief Build a xyz2yzx plane from the column x of all slices, i.e., dst(z, y) = images[z](y, x).
+         */
+        inline void gather_columns(const std::vector<cv::Mat> &images, const int x, cv::Mat &dst) {
+                dst.create(int(images.size()), images[0].rows, images[0].type());
+                for (int z = 0; z < dst.rows; ++z) {
+                        const cv::Mat &image = images[size_t(z)];
+                        mi::transpose(image.ptr() + x * image.elemSize(), image.step, dst.ptr(z), dst.step, image.rows, 1, image.elemSize());
+                }
+        }
+
+        /**
+         * @brief Build a xzy plane from the row y of all slices, i.e., dst(z, x) = images[z](y, x).
+         */
+        inline void stack_rows(const std::vector<cv::Mat> &images, const int y, cv::Mat &dst) {
+                dst.create(int(images.size()), images[0].cols, images[0].type());
+                for (int z = 0; z < dst.rows; ++z) {
+                        images[size_t(z)].row(y).copyTo(dst.row(z));
+                }
+        }
+
+        /**
+         * @brief Build a zyx plane from the column x of all slices, i.e., dst(y, z) = images[z](y, x).
+         */
+        inline void stack_columns(const std::vector<cv::Mat> &images, const int x, cv::Mat &dst) {
+                dst.create(images[0].rows, int(images.size()), images[0].type());
+                for (int z = 0; z < dst.cols; ++z) {
+                        images[size_t(z)].col(x).copyTo(dst.col(z));
+                }
+        }
+
+        /**
+         * @brief Convert a size string such as "512M", "64G" or "1.5T" into bytes.
+         * @throw runtime_error if the string is not a size.
+         */
+        inline size_t parse_memory_size(const std::string &str) {
+                size_t pos = 0;
+                double value = 0;
+                try {
+                        value = std::stod(str, &pos);
+                } catch (std::exception &) {
+                        throw std::runtime_error("Invalid memory size : " + str);
+                }
+                const std::string units = "KMGT";
+                double scale = 1;
+                if (pos + 1 == str.size()) {
+                        const auto u = units.find(char(std::toupper(str[pos])));
+                        if (u == std::string::npos) {
+                                throw std::runtime_error("Invalid memory size : " + str);
+                        }
+                        scale = std::pow(1024.0, double(u + 1));
+                } else if (pos != str.size()) {
+                        throw std::runtime_error("Invalid memory size : " + str);
+                }
+                if (value <= 0) {
+                        throw std::runtime_error("Invalid memory size : " + str);
+                }
+                return size_t(value * scale);
+        }
+
+        /**
+         * @brief Whether the output path is a single BigTIFF.
+         */
+        inline bool is_stack_path(const std::filesystem::path &p) {
+                return p.extension() == ".tif" || p.extension() == ".tiff" || p.extension() == ".btf";
+        }
+
+        /**
+         * @brief Check whether the TIFF encoder supports the compression scheme (e.g., zstd depends on the build of libtiff).
+         */
+        inline bool is_tiff_compression_supported(const int scheme) {
+                std::vector<uint8_t> buffer;
+                try {
+                        return cv::imencode(".tif", cv::Mat(1, 1, CV_8UC1, cv::Scalar(0)), buffer, {cv::IMWRITE_TIFF_COMPRESSION, scheme});
+                } catch (cv::Exception &) {
+                        return false;
+                }
+        }
+
+        /**
+         * @brief Parameters of cv::imwrite for the compression of the output images.
+         * @param extension .tif or .png. The other formats take no compression.
+         * @param compress none, lzw, deflate or zstd (zstd falls back to deflate if libtiff lacks it). empty : no compression for TIFF and the default of OpenCV for PNG.
+         * @param level Compression level of PNG (0 - 9). -1 : the default.
+         * @throw runtime_error if the format does not support the compression.
+         */
+        inline std::vector<int> compression_params(const std::filesystem::path &extension, const std::string &compress, const int level) {
+                if (extension == ".tif" || extension == ".tiff") {
+                        const std::map<std::string, int> schemes{{"", 1}, {"none", 1}, {"lzw", 5}, {"deflate", 8}, {"zstd", 50000}};
+                        const auto it = schemes.find(compress);
+                        if (it == schemes.end()) {
+                                throw std::runtime_error("Unknown compression : " + compress);
+                        }
+                        int scheme = it->second;
+                        if (compress == "zstd" && !xyz2zxy::is_tiff_compression_supported(scheme)) {
+                                std::cerr << "zstd is not supported by libtiff. deflate is used instead." << std::endl;
+                                scheme = 8;
+                        }
+                        return {cv::IMWRITE_TIFF_COMPRESSION, scheme};
+                }
+                if (extension == ".png") {
+                        if (compress != "" && compress != "none" && compress != "deflate") {
+                                throw std::runtime_error("PNG does not support " + compress + ".");
+                        }
+                        const int l = (compress == "none") ? 0 : level;
+                        return (l >= 0) ? std::vector<int>{cv::IMWRITE_PNG_COMPRESSION, l} : std::vector<int>();
+                }
+                if (compress != "" && compress != "none") {
+                        throw std::runtime_error("Compression is supported for .tif and .png only.");
+                }
+                return {};
+        }
+
+        /**
+         * @brief Policy of the page cache of options::cache.
+         */
+        inline mi::cache_policy cache_policy(const std::string &cache) {
+                return cache == "direct" ? mi::cache_policy::direct : cache == "drop" ? mi::cache_policy::drop : mi::cache_policy::keep;
+        }
+
+        /**
+         * @brief Check the axis order "abc" of the output, where a, b and c are the column, the row and the slice axes of the output images.
+         * @note The input is "xyz".
+         */
+        inline bool is_valid_order(std::string order) {
+                std::sort(order.begin(), order.end());
+                return order == "xyz";
+        }
+
+        /**
+         * @brief Sub-box of the input volume.
+         */
+        struct region {
+                uint32_t x = 0, y = 0, z = 0; ///< the first voxel.
+                uint32_t width = 0, height = 0, depth = 0;
+
+                [[nodiscard]] bool is_empty() const {
+                        return this->width == 0 || this->height == 0 || this->depth == 0;
+                }
+
+                /// the region in a slice.
+                [[nodiscard]] cv::Rect rect() const {
+                        return cv::Rect(int(this->x), int(this->y), int(this->width), int(this->height));
+                }
+        };
+
+        /**
+         * @brief Options of the conversion.
+         */
+        struct options {
+                std::filesystem::path input;
+                std::filesystem::path output = "output";
+                std::string order = "zxy"; ///< axis order of the output.
+                int step = 0; ///< the number of slices in a chunk. 0 : computed from mem_limit.
+                std::filesystem::path extension = ".tif";
+                std::vector<int> params; ///< parameters of cv::imwrite.
+                size_t mem_limit = 0; ///< memory budget in bytes. 0 : memory_budget().
+                std::string scratch = "brick";
+                std::string cache = "keep"; ///< use of the page cache by the input, the scratch and the output (keep, drop or direct).
+                int merge = 0; ///< the number of strips of a plane read in Step2 at most (files scratch). Strips are merged beforehand if there are more. 0 : never merged.
+                int prefetch = 1;
+                int threads = 0; ///< the number of worker threads. 0 : hardware concurrency.
+                std::filesystem::path tmp_dir; ///< directory of the temporary data. empty : {output}_temp.
+                bool is_resumed = false; ///< skip the work recorded in the checkpoint of tmp_dir.
+                region roi; ///< region of interest. empty : the whole volume.
+                int pyramid = 0; ///< the number of downsampled levels (2x, 4x, ...) written with the output.
+                int block = 64; ///< edge of the 3D blocks of the chunked output (.zarr).
+                std::string compress; ///< none, lzw, deflate or zstd. empty : the default of the format.
+                int level = -1; ///< compression level of PNG and the chunked output. -1 : the default.
+                std::string progress = "auto"; ///< progress of the stages (bar, json or none). auto : bar on a terminal, json otherwise.
+                bool is_verbose = true; ///< show the progress and the messages.
+                std::filesystem::path report; ///< JSON report of the run. empty : no report.
+        };
+
+        /**
+         * @brief Counters of a run.
+         * @note Times of operations are summed over threads. Counters are updated concurrently.
+         */
+        struct statistics {
+                using clock = std::chrono::steady_clock;
+
+                /**
+                 * @brief Add the time of the scope to a counter in nanoseconds.
+                 */
+                class scoped_timer {
+                private:
+                        std::atomic<uint64_t> &ns_;
+                        clock::time_point begin_;
+                public:
+                        explicit scoped_timer(std::atomic<uint64_t> &ns) : ns_(ns), begin_(clock::now()) {}
+
+                        scoped_timer(const scoped_timer &that) = delete;
+
+                        scoped_timer &operator=(const scoped_timer &that) = delete;
+
+                        ~scoped_timer() {
+                                this->ns_ += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - this->begin_).count());
+                        }
+                };
+
+                std::string mode; ///< in-memory, out-of-core or streaming.
+                uint32_t sx = 0, sy = 0, sz = 0;
+                int type = 0;
+                uint32_t step = 0;
+                uint32_t threads = 0; ///< workers (in Step2 for out-of-core).
+                uint32_t band_rows = 0; ///< rows of the slices read at once in Step1.
+                uint32_t merge_levels = 0; ///< levels merging the strips between Step1 and Step2.
+                std::string io; ///< the way of I/O of the scratch.
+                std::vector<std::pair<std::string, double>> stages; ///< wall time [s] of the stages.
+                std::atomic<uint64_t> decode_ns{0}, transpose_ns{0}, encode_ns{0}, scratch_write_ns{0}, scratch_read_ns{0};
+                std::atomic<uint64_t> input_bytes{0}, scratch_read_bytes{0}, scratch_written_bytes{0}, output_bytes{0};
+                std::atomic<uint64_t> scratch_files{0}, output_files{0};
+                std::atomic<uint64_t> resumed_chunks{0}, resumed_planes{0}; ///< work skipped by --resume.
+
+                void add_stage(const std::string &name, const clock::time_point &begin) {
+                        this->stages.emplace_back(name, std::chrono::duration<double>(clock::now() - begin).count());
+                }
+
+                /**
+                 * @throw runtime_error if the file cannot be written.
+                 */
+                void save(const std::filesystem::path &filename, const options &opt) const {
+                        auto sec = [](const std::atomic<uint64_t> &ns) { return double(ns) * 1.0e-9; };
+                        double total = 0;
+                        std::ofstream fout(filename);
+                        fout << "{\n"
+                             << "  \"version\": " << mi::json_string(XYZ2ZXY_VERSION) << ",\n"
+                             << "  \"input\": " << mi::json_string(opt.input.string()) << ",\n"
+                             << "  \"output\": " << mi::json_string(opt.output.string()) << ",\n"
+                             << "  \"order\": " << mi::json_string(opt.order) << ",\n"
+                             << "  \"mode\": " << mi::json_string(this->mode) << ",\n"
+                             << "  \"scratch\": " << mi::json_string(opt.scratch) << ",\n"
+                             << "  \"mem_limit\": " << opt.mem_limit << ",\n"
+                             << "  \"merge\": " << opt.merge << ",\n"
+                             << "  \"cache\": " << mi::json_string(opt.cache) << ",\n"
+                             << "  \"pyramid\": " << opt.pyramid << ",\n"
+                             << "  \"block\": " << opt.block << ",\n"
+                             << "  \"compress\": " << mi::json_string(opt.compress) << ",\n"
+                             << "  \"level\": " << opt.level << ",\n"
+                             << "  \"roi\": [" << opt.roi.x << ", " << opt.roi.y << ", " << opt.roi.z << ", " << opt.roi.width << ", " << opt.roi.height << ", " << opt.roi.depth << "],\n"
+                             << "  \"volume\": {\"sx\": " << this->sx << ", \"sy\": " << this->sy << ", \"sz\": " << this->sz << ", \"type\": " << this->type
+                             << ", \"bytes\": " << size_t(this->sx) * this->sy * this->sz * CV_ELEM_SIZE(this->type) << "},\n"
+                             << "  \"step\": " << this->step << ",\n"
+                             << "  \"threads\": " << this->threads << ",\n"
+                             << "  \"band_rows\": " << this->band_rows << ",\n"
+                             << "  \"merge_levels\": " << this->merge_levels << ",\n"
+                             << "  \"io\": " << mi::json_string(this->io) << ",\n"
+                             << "  \"stages\": [";
+                        for (size_t i = 0; i < this->stages.size(); ++i) {
+                                fout << (i == 0 ? "" : ", ") << "{\"name\": " << mi::json_string(this->stages[i].first) << ", \"wall_sec\": " << this->stages[i].second << "}";
+                                total += this->stages[i].second;
+                        }
+                        fout << "],\n"
+                             << "  \"wall_sec\": " << total << ",\n"
+                             << "  \"thread_sec\": {\"decode\": " << sec(this->decode_ns) << ", \"transpose\": " << sec(this->transpose_ns) << ", \"encode\": " << sec(this->encode_ns)
+                             << ", \"scratch_write\": " << sec(this->scratch_write_ns) << ", \"scratch_read\": " << sec(this->scratch_read_ns) << "},\n"
+                             << "  \"bytes_read\": {\"input\": " << this->input_bytes << ", \"scratch\": " << this->scratch_read_bytes << "},\n"
+                             << "  \"bytes_written\": {\"scratch\": " << this->scratch_written_bytes << ", \"output\": " << this->output_bytes << "},\n"
+                             << "  \"files_created\": {\"scratch\": " << this->scratch_files << ", \"output\": " << this->output_files << "},\n"
+                             << "  \"resumed\": {\"chunks\": " << this->resumed_chunks << ", \"planes\": " << this->resumed_planes << "},\n"
+                             << "  \"peak_rss\": " << mi::peak_memory_size() << "\n"
+                             << "}" << std::endl;
+                        if (!fout) {
+                                throw std::runtime_error(filename.string() + " cannot be written.");
+                        }
+                }
+        };
+
+        /**
+         * @brief Parse the arguments.
+         * @param opt Default values are given by the caller.
+         * @throw runtime_error if arguments are insufficient or invalid.
+         */
+        void init_arguments(const std::string &cmd, mi::Argument &arg, options &opt) {
                 mi::AttributeSet attrSet;
                 std::tuple<double, double> pitch(25.4, 25.4);
-                attrSet.createAttribute("-i", input_dir).setMessage("Input directory").setMandatory();
-                attrSet.createAttribute("-o", outputDir).setMessage("Output directory (default : output/)");
-                attrSet.createAttribute("-n", step).setMessage(
-                        "The number of steps (Default: 100, Larger n is probably fast but it causes large memory consumption.)").setValidator(
+                std::tuple<int, int, int, int, int, int> roi(0, 0, 0, 0, 0, 0);
+                std::string mem_limit_str;
+                std::filesystem::path tmp_root;
+                attrSet.createAttribute("-i", opt.input).setMessage("Input directory").setMandatory();
+                attrSet.createAttribute("-o", opt.output).setMessage("Output directory (default : output/)");
+                attrSet.createAttribute("-n", opt.step).setMessage(
+                        "The number of steps (Default: computed from --mem-limit, Larger n is probably fast but it causes large memory consumption.)").setValidator(
                         mi::attr::greater(0));
-                attrSet.createAttribute("-ext", extension).setMessage(
+                attrSet.createAttribute("-ext", opt.extension).setMessage(
                         "Extension of the images (e.g., .tif, .png. Default : .tif)");
                 attrSet.createAttribute("-p", pitch).setMessage("Pixel resolution").setValidator([](const std::tuple<double, double>& v){ return std::get<0>(v)>0 && std::get<1>(v)>0;});
+                attrSet.createAttribute("--order", opt.order).setMessage("Axis order of the output (xyz, xzy, yxz, yzx, zxy or zyx. Default : " + opt.order + ")").setValidator(
+                        [](const std::string &v) { return xyz2zxy::is_valid_order(v); }, true);
+                attrSet.createAttribute("--roi", roi).setMessage("Region of interest x0 y0 z0 w h d (Default : the whole volume)").setValidator([](const std::tuple<int, int, int, int, int, int> &v) {
+                        return std::get<0>(v) >= 0 && std::get<1>(v) >= 0 && std::get<2>(v) >= 0 && std::get<3>(v) > 0 && std::get<4>(v) > 0 && std::get<5>(v) > 0;
+                }, true);
+                attrSet.createAttribute("--pyramid", opt.pyramid).setMessage("The number of downsampled levels written as {output}_2x, {output}_4x, ... (Default : 0)").setValidator(
+                        mi::attr::greater_equal(0), true);
+                attrSet.createAttribute("--chunk", opt.block).setMessage("Edge of the 3D blocks of the chunked output ({output}.zarr. Default : 64)").setValidator(
+                        mi::attr::greater(0), true);
+                attrSet.createAttribute("--compress", opt.compress).setMessage("Compression of the output (none, lzw, deflate or zstd. Default : none for .tif, deflate for .png and .zarr)").setValidator(
+                        [](const std::string &v) { return v == "none" || v == "lzw" || v == "deflate" || v == "zstd"; }, true);
+                attrSet.createAttribute("--level", opt.level).setMessage("Compression level of .png and .zarr (0 - 9)").setValidator(mi::attr::between_equal(0, 9), true);
+                attrSet.createAttribute("--mem-limit", mem_limit_str).setMessage("Memory budget (e.g., 512M, 64G. Default : 80% of available memory)");
+                attrSet.createAttribute("--prefetch", opt.prefetch).setMessage("The number of chunks read ahead in Step1 (Default : 1, 0 disables prefetching)").setValidator(
+                        mi::attr::greater_equal(0), true);
+                attrSet.createAttribute("-t", opt.threads).setMessage("The number of threads (Default : 0, the number of hardware threads)").setValidator(
+                        mi::attr::greater_equal(0), true);
+                attrSet.createAttribute("--tmp", tmp_root).setMessage("Directory where the temporary data is created, e.g., on another device (Default : the directory of the output)");
+                attrSet.createAttribute("--report", opt.report).setMessage("JSON file of the run report (stage times, bytes, files and peak memory)");
+                attrSet.createAttribute("--resume", opt.is_resumed).setMessage("Resume the conversion stopped halfway (the temporary directory is reused)");
+                attrSet.createAttribute("--scratch", opt.scratch).setMessage("Storage of temporary data (brick : a memory-mapped file, files : a file per strip. Default : brick)").setValidator(
+                        [](const std::string &v) { return v == "brick" || v == "files"; }, true);
+                attrSet.createAttribute("--cache", opt.cache).setMessage("Use of the page cache (keep : left to the kernel, drop : read ahead and dropped after use, direct : drop, and O_DIRECT for --scratch files. Default : keep)").setValidator(
+                        [](const std::string &v) { return v == "keep" || v == "drop" || v == "direct"; }, true);
+                attrSet.createAttribute("--progress", opt.progress).setMessage("Progress of the stages (bar : a line with the rates and ETA, json : a JSON line every 5 seconds, none. Default : auto, bar on a terminal and json otherwise)").setValidator(
+                        [](const std::string &v) { return v == "auto" || v == "bar" || v == "json" || v == "none"; }, true);
+                attrSet.createAttribute("--merge", opt.merge).setMessage("The number of strips of a plane read in Step2 at most. More strips are merged beforehand (files scratch. Default : 0, never merged)").setValidator(
+                        mi::attr::greater_equal(0), true);
 
                 if (!attrSet.parse(arg)) {
                         std::cerr << cmd << " version. " << XYZ2ZXY_VERSION << std::endl;
@@ -78,59 +820,1843 @@ namespace xyz2zxy {
                         attrSet.printUsage();
                         throw std::runtime_error("Insufficient arguments");
                 }
-                if (extension == ".tif") { //only tif
-                        params.emplace_back(cv::IMWRITE_TIFF_COMPRESSION);
-                        params.emplace_back(1); // no compression
+                opt.mem_limit = mem_limit_str.empty() ? xyz2zxy::memory_budget() : xyz2zxy::parse_memory_size(mem_limit_str);
+                if (arg.exist("--tmp")) {
+                        const std::filesystem::path output = opt.output.has_filename() ? opt.output : opt.output.parent_path();
+                        opt.tmp_dir = tmp_root / (output.filename().string() + "_temp");
+                }
+                if (arg.exist("--roi")) {
+                        const auto [x, y, z, w, h, d] = roi;
+                        opt.roi = region{uint32_t(x), uint32_t(y), uint32_t(z), uint32_t(w), uint32_t(h), uint32_t(d)};
+                }
+                // a BigTIFF output is encoded as tif regardless of the extension.
+                opt.params = xyz2zxy::compression_params(xyz2zxy::is_stack_path(opt.output) ? std::filesystem::path(".tif") : opt.extension, opt.compress, opt.level);
+                if (opt.extension == ".tif") { //only tif
                         if (arg.exist("-p")) {
                                 // dpi =  25.4 mm / (pitch mm/pixel) (inch)
-                                params.emplace_back(cv::IMWRITE_TIFF_XDPI);
-                                params.emplace_back(std::round(25400.0 / std::get<0>(pitch)));
-                                params.emplace_back(cv::IMWRITE_TIFF_YDPI);
-                                params.emplace_back(std::round(25400.0 / std::get<1>(pitch)));
+                                opt.params.emplace_back(cv::IMWRITE_TIFF_XDPI);
+                                opt.params.emplace_back(std::round(25400.0 / std::get<0>(pitch)));
+                                opt.params.emplace_back(cv::IMWRITE_TIFF_YDPI);
+                                opt.params.emplace_back(std::round(25400.0 / std::get<1>(pitch)));
                         }
                 }
         }
 
 
-        std::vector<std::filesystem::path> list_files(const std::filesystem::path &p, const std::filesystem::path &tmp) {
+        std::vector<std::filesystem::path> list_files(const std::filesystem::path &p) {
                 std::vector<std::filesystem::path> image_paths;
-                if (std::filesystem::is_directory(p)) {
-                        std::copy_if(std::filesystem::directory_iterator(p), std::filesystem::directory_iterator(), std::back_inserter(image_paths), [](const auto &f) {
-                                             return !std::filesystem::is_directory(f) && f.path().filename().string().find_first_of(".") != 0;
-                                     }
-                        );
-                } else if (p.extension() == ".tif" || p.extension() == ".tiff") {
-                        auto input_dir = tmp / "input";
-                        xyz2zxy::create_directory(input_dir);
-
-                        std::vector<int> params = {cv::IMWRITE_TIFF_COMPRESSION, 1};
-                        std::vector<cv::Mat> images;
-                        const int n = int(cv::imcount(p.string()));
-                        for (int i = 0; i < n; ++i) {
-                                cv::imreadmulti(p.string(), images, i, 1, cv::IMREAD_UNCHANGED);
-                                std::stringstream ss;
-                                ss << "image-" << std::setw(5) << std::setfill('0') << i << ".tif";
-                                image_paths.push_back(input_dir / ss.str());
-                                //image_paths.push_back(input_dir / fmt::format("image-{:05}.tif", i));
-                                cv::imwrite(image_paths[i].string(), images[0], params);
-                        }
-                } else {
-                        throw std::runtime_error("Unsupported format");
-                }
-                if (image_paths.empty()) {
-                        throw std::runtime_error("Empty images");
-                }
+                std::copy_if(std::filesystem::directory_iterator(p), std::filesystem::directory_iterator(), std::back_inserter(image_paths), [](const auto &f) {
+                                     return !std::filesystem::is_directory(f) && f.path().filename().string().find_first_of(".") != 0;
+                             }
+                );
                 std::sort(image_paths.begin(), image_paths.end());
                 return image_paths;
         }
 
-        void get_volume_size(std::vector<std::filesystem::path> &image_paths, uint32_t &sx, uint32_t &sy, uint32_t &sz) {
-                cv::Mat image = cv::imread(image_paths[0].string(), cv::IMREAD_UNCHANGED);
-                sx = uint32_t(image.size().width);
-                sy = uint32_t(image.size().height);
-                sz = uint32_t(image_paths.size());
+        /**
+         * @brief Decode a region of a page of a TIFF.
+         * @param rect Region of the page. Empty : the whole page.
+         * @note Uncompressed 8/16-bit strips are copied directly from the file. Other pages are passed to cv::imdecode.
+         * Only the strips covering the rows of the region are decoded unless the page is tiled.
+         * @return Empty image if the page cannot be decoded.
+         * @throw runtime_error if the page has fewer strips than its rows.
+         */
+        inline cv::Mat decode_tiff_page(const mi::tiff_reader &reader, const size_t i, cv::Rect rect = cv::Rect()) {
+                const mi::tiff_page &page = reader.page(i);
+                const cv::Rect whole(0, 0, int(page.width()), int(page.height()));
+                if (rect.area() == 0) {
+                        rect = whole;
+                } else if ((rect & whole).area() != rect.area()) {
+                        return {};
+                }
+                const uint32_t bits = page.bits();
+                const uint32_t channels = page.samples();
+                const uint64_t photometric = page.get(mi::tiff_tag::photometric, 0, 1);
+                const bool is_gray = (channels == 1 && photometric == 1);
+                const bool is_color = (channels == 3 || (channels == 4 && page.get(mi::tiff_tag::extra_samples) == 2)) && photometric == 2 && page.get(mi::tiff_tag::planar_config, 0, 1) == 1;
+                if (page.compression() != 1 || page.is_tiled() || (bits != 8 && bits != 16) || page.get(mi::tiff_tag::sample_format, 0, 1) != 1 || !(is_gray || is_color)) {
+                        const bool is_partial = !page.is_tiled() && rect.height < whole.height;
+                        const uint32_t first_row = is_partial ? uint32_t(rect.y) / std::max(page.rows_per_strip(), 1u) * std::max(page.rows_per_strip(), 1u) : 0; // the first row of the strips
+                        const std::string buffer = is_partial ? mi::extract_tiff_page(reader, i, uint32_t(rect.y), uint32_t(rect.y + rect.height)) : mi::extract_tiff_page(reader, i);
+                        const cv::Mat image = cv::imdecode(cv::Mat(1, int(buffer.size()), CV_8UC1, const_cast<char *>(buffer.data())), cv::IMREAD_UNCHANGED);
+                        if (image.empty() || rect == whole) {
+                                return image;
+                        } else if (image.rows < rect.y - int(first_row) + rect.height || image.cols < rect.x + rect.width) {
+                                return {};
+                        }
+                        return image(cv::Rect(rect.x, rect.y - int(first_row), rect.width, rect.height)).clone();
+                }
+                cv::Mat image(rect.height, rect.width, CV_MAKETYPE(bits == 8 ? CV_8U : CV_16U, int(channels)));
+                const size_t row_bytes = image.cols * image.elemSize();
+                const size_t column_offset = rect.x * image.elemSize();
+                const size_t stride = whole.width * image.elemSize();
+                const uint32_t rows_per_strip = std::max(page.rows_per_strip(), 1u);
+                const auto strips = reader.chunks(i);
+                for (int y = 0; y < image.rows; ++y) {
+                        const size_t s = (rect.y + y) / rows_per_strip;
+                        const size_t offset = ((rect.y + y) % rows_per_strip) * stride + column_offset;
+                        if (s >= strips.size() || offset + row_bytes > strips[s].second) {
+                                return {};
+                        }
+                        std::memcpy(image.ptr(y), strips[s].first + offset, row_bytes);
+                }
+                if (bits == 16 && reader.byte_order().is_big_endian()) {
+                        for (int y = 0; y < image.rows; ++y) {
+                                auto *p = image.ptr<uint16_t>(y);
+                                std::transform(p, p + image.cols * channels, p, [](const uint16_t v) { return uint16_t((v >> 8) | (v << 8)); });
+                        }
+                }
+                if (is_color) { // RGB to BGR as cv::imread does
+                        const size_t depth = bits / 8;
+                        for (int y = 0; y < image.rows; ++y) {
+                                for (uint8_t *p = image.ptr(y); p < image.ptr(y) + row_bytes; p += image.elemSize()) {
+                                        std::swap_ranges(p, p + depth, p + 2 * depth);
+                                }
+                        }
+                }
+                return image;
         }
 
+        /**
+         * @brief Input slices.
+         * @note read() is called from multiple threads.
+         */
+        class slice_source {
+        public:
+                virtual ~slice_source() = default;
+
+                [[nodiscard]] virtual uint32_t size() const = 0;
+
+                /**
+                 * @brief Read a slice.
+                 * @return Empty image if the slice cannot be read.
+                 */
+                [[nodiscard]] virtual cv::Mat read(uint32_t z) const = 0;
+
+                /**
+                 * @brief Read a region of a slice.
+                 * @return Empty image if the slice cannot be read.
+                 * @note The whole slice is read and the region is copied by default. Sources that can read a part of a slice override it.
+                 */
+                [[nodiscard]] virtual cv::Mat read(const uint32_t z, const cv::Rect &rect) const {
+                        const cv::Mat image = this->read(z);
+                        return image.empty() ? image : cv::Mat(image, rect).clone();
+                }
+
+                /**
+                 * @brief Whether read(z, rect) reads only the rows of the region, so that slices can be read by row bands.
+                 */
+                [[nodiscard]] virtual bool is_partial() const {
+                        return false;
+                }
+
+                /**
+                 * @brief Hint that the slices [begin, end) are read soon, so that the kernel reads them ahead.
+                 */
+                virtual void will_need([[maybe_unused]] uint32_t begin, [[maybe_unused]] uint32_t end) const {}
+
+                /**
+                 * @brief Drop the slices [begin, end) from the page cache. They are not read any more.
+                 */
+                virtual void drop([[maybe_unused]] uint32_t begin, [[maybe_unused]] uint32_t end) const {}
+
+                /// name of the slice in messages.
+                [[nodiscard]] virtual std::string name(uint32_t z) const = 0;
+        };
+
+        /**
+         * @brief Slices stored as image files in a directory.
+         */
+        class files_source : public slice_source {
+        private:
+                std::vector<std::filesystem::path> image_paths_;
+        public:
+                using slice_source::read;
+
+                explicit files_source(const std::filesystem::path &dir) : image_paths_(xyz2zxy::list_files(dir)) {}
+
+                [[nodiscard]] uint32_t size() const override {
+                        return uint32_t(this->image_paths_.size());
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z) const override {
+                        return cv::imread(this->image_paths_[z].string(), cv::IMREAD_UNCHANGED);
+                }
+
+                void will_need(const uint32_t begin, const uint32_t end) const override {
+                        std::for_each(this->image_paths_.begin() + begin, this->image_paths_.begin() + end, [](auto &p) { mi::will_need(p); });
+                }
+
+                void drop(const uint32_t begin, const uint32_t end) const override {
+                        std::for_each(this->image_paths_.begin() + begin, this->image_paths_.begin() + end, [](auto &p) { mi::drop_cache(p); });
+                }
+
+                [[nodiscard]] std::string name(const uint32_t z) const override {
+                        return this->image_paths_[z].string();
+                }
+        };
+
+        /**
+         * @brief Pages of a multi-page TIFF. Pages are read in place without extraction.
+         */
+        class tiff_source : public slice_source {
+        private:
+                std::filesystem::path path_;
+                mi::tiff_reader reader_;
+        public:
+                explicit tiff_source(const std::filesystem::path &path) : path_(path), reader_(path) {}
+
+                [[nodiscard]] uint32_t size() const override {
+                        return uint32_t(this->reader_.pages());
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z) const override {
+                        try {
+                                return xyz2zxy::decode_tiff_page(this->reader_, z);
+                        } catch (std::exception &) {
+                                return {};
+                        }
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z, const cv::Rect &rect) const override {
+                        try {
+                                return xyz2zxy::decode_tiff_page(this->reader_, z, rect);
+                        } catch (std::exception &) {
+                                return {};
+                        }
+                }
+
+                void will_need(const uint32_t begin, const uint32_t end) const override {
+                        this->reader_.will_need(begin, end);
+                }
+
+                void drop(const uint32_t begin, const uint32_t end) const override {
+                        this->reader_.drop(begin, end);
+                }
+
+                [[nodiscard]] bool is_partial() const override {
+                        return this->reader_.pages() > 0 && !this->reader_.page(0).is_tiled();
+                }
+
+                [[nodiscard]] std::string name(const uint32_t z) const override {
+                        return this->path_.string() + " (page " + std::to_string(z) + ")";
+                }
+        };
+
+        /**
+         * @brief Header of a NRRD volume. Only the raw encoding is supported.
+         * @note The data follow the header (.nrrd) or are in "data file" (.nhdr).
+         */
+        struct nrrd_header {
+                int type = -1;
+                uint32_t sx = 0, sy = 0, sz = 0;
+                bool is_big_endian = false;
+                std::filesystem::path data_file;
+                size_t offset = 0; ///< byte offset of the voxels in the data file.
+
+                /**
+                 * @throw runtime_error if the header is broken or not supported.
+                 */
+                void load(const std::filesystem::path &filename) {
+                        std::ifstream fin(filename, std::ios::binary);
+                        std::string line;
+                        if (!std::getline(fin, line) || line.rfind("NRRD000", 0) != 0) {
+                                throw std::runtime_error(filename.string() + " is not NRRD.");
+                        }
+                        int depth = -1;
+                        std::vector<uint32_t> sizes;
+                        long long byte_skip = 0;
+                        std::string encoding = "raw";
+                        while (std::getline(fin, line) && !line.empty() && line != "\r") {
+                                const auto pos = line.find(": ");
+                                if (line[0] == '#' || pos == std::string::npos) {
+                                        continue; // comments and key/value pairs
+                                }
+                                const std::string key = line.substr(0, pos);
+                                std::string value = line.substr(pos + 2);
+                                value.erase(value.find_last_not_of(" \r") + 1);
+                                std::stringstream ss(value);
+                                if (key == "type") {
+                                        if (value == "uchar" || value == "unsigned char" || value == "uint8" || value == "uint8_t") {
+                                                depth = CV_8U;
+                                        } else if (value == "signed char" || value == "int8" || value == "int8_t") {
+                                                depth = CV_8S;
+                                        } else if (value == "ushort" || value == "unsigned short" || value == "unsigned short int" || value == "uint16" || value == "uint16_t") {
+                                                depth = CV_16U;
+                                        } else {
+                                                throw std::runtime_error("Unsupported type : " + value);
+                                        }
+                                } else if (key == "sizes") {
+                                        for (uint32_t v; ss >> v;) {
+                                                sizes.push_back(v);
+                                        }
+                                } else if (key == "endian") {
+                                        this->is_big_endian = (value == "big");
+                                } else if (key == "encoding") {
+                                        encoding = value;
+                                } else if (key == "byte skip" || key == "byteskip") {
+                                        ss >> byte_skip;
+                                } else if (key == "data file" || key == "datafile") {
+                                        this->data_file = filename.parent_path() / value;
+                                }
+                        }
+                        if (encoding != "raw") {
+                                throw std::runtime_error("Unsupported encoding : " + encoding);
+                        }
+                        // 3D volume, optionally with channels as the fastest axis.
+                        const uint32_t channels = (sizes.size() == 4) ? sizes[0] : 1;
+                        if (depth < 0 || (sizes.size() != 3 && sizes.size() != 4) || channels < 1 || channels > 4) {
+                                throw std::runtime_error(filename.string() + " : unsupported type or sizes.");
+                        }
+                        this->type = CV_MAKETYPE(depth, int(channels));
+                        this->sx = sizes[sizes.size() - 3];
+                        this->sy = sizes[sizes.size() - 2];
+                        this->sz = sizes[sizes.size() - 1];
+                        if (this->data_file.empty()) {
+                                this->data_file = filename;
+                                this->offset = size_t(fin.tellg());
+                        }
+                        if (byte_skip < 0) { // -1 : the voxels are at the end of the file.
+                                this->offset = std::filesystem::file_size(this->data_file) - this->volume_bytes();
+                        } else {
+                                this->offset += size_t(byte_skip);
+                        }
+                }
+
+                [[nodiscard]] size_t volume_bytes() const {
+                        return size_t(this->sx) * this->sy * this->sz * CV_ELEM_SIZE(this->type);
+                }
+        };
+
+        /**
+         * @brief Slices of a raw volume (NRRD) mapped on the memory.
+         * @note Slices are served without copy unless the byte order must be swapped.
+         */
+        class raw_source : public slice_source {
+        private:
+                std::filesystem::path path_;
+                nrrd_header header_;
+                std::unique_ptr<mi::mapped_file> file_;
+        public:
+                /**
+                 * @throw runtime_error if the header is not supported or the data are too short.
+                 */
+                explicit raw_source(const std::filesystem::path &path) : path_(path) {
+                        this->header_.load(path);
+                        this->file_ = std::make_unique<mi::mapped_file>(this->header_.data_file);
+                        if (this->file_->size() < this->header_.offset + this->header_.volume_bytes()) {
+                                throw std::runtime_error(this->header_.data_file.string() + " is too short.");
+                        }
+                }
+
+                [[nodiscard]] uint32_t size() const override {
+                        return this->header_.sz;
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z) const override {
+                        return this->read(z, cv::Rect(0, 0, int(this->header_.sx), int(this->header_.sy)));
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z, const cv::Rect &rect) const override {
+                        const size_t slice_bytes = this->header_.volume_bytes() / this->header_.sz;
+                        const cv::Mat slice = cv::Mat(int(this->header_.sy), int(this->header_.sx), this->header_.type, this->file_->data() + this->header_.offset + z * slice_bytes)(rect); // only the rows in rect are touched
+                        if (CV_ELEM_SIZE1(this->header_.type) == 2 && this->header_.is_big_endian != (std::endian::native == std::endian::big)) {
+                                cv::Mat swapped = slice.clone();
+                                for (int y = 0; y < swapped.rows; ++y) {
+                                        auto *p = swapped.ptr<uint16_t>(y);
+                                        std::transform(p, p + swapped.cols * swapped.channels(), p, [](const uint16_t v) { return uint16_t((v >> 8) | (v << 8)); });
+                                }
+                                return swapped;
+                        }
+                        return slice;
+                }
+
+                [[nodiscard]] bool is_partial() const override {
+                        return true;
+                }
+
+                void will_need(const uint32_t begin, const uint32_t end) const override {
+                        const size_t slice_bytes = this->header_.volume_bytes() / this->header_.sz;
+                        this->file_->will_need(this->file_->data() + this->header_.offset + begin * slice_bytes, (end - begin) * slice_bytes);
+                }
+
+                void drop(const uint32_t begin, const uint32_t end) const override {
+                        const size_t slice_bytes = this->header_.volume_bytes() / this->header_.sz;
+                        this->file_->drop(this->file_->data() + this->header_.offset + begin * slice_bytes, (end - begin) * slice_bytes);
+                }
+
+                [[nodiscard]] std::string name(const uint32_t z) const override {
+                        return this->path_.string() + " (slice " + std::to_string(z) + ")";
+                }
+        };
+
+        /**
+         * @brief Slices on the memory.
+         */
+        class mat_source : public slice_source {
+        private:
+                std::vector<cv::Mat> images_;
+        public:
+                /**
+                 * @note Images are shared, not copied. All images must have the same size and type.
+                 */
+                explicit mat_source(std::vector<cv::Mat> images) : images_(std::move(images)) {}
+
+                [[nodiscard]] uint32_t size() const override {
+                        return uint32_t(this->images_.size());
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z) const override {
+                        return this->images_[z];
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z, const cv::Rect &rect) const override {
+                        return this->images_[z](rect);
+                }
+
+                [[nodiscard]] bool is_partial() const override {
+                        return true;
+                }
+
+                [[nodiscard]] std::string name(const uint32_t z) const override {
+                        return "image " + std::to_string(z);
+                }
+        };
+
+        /**
+         * @brief Open input slices (a directory of images, a multi-page TIFF or a NRRD volume).
+         * @throw runtime_error if the input is not supported or empty.
+         */
+        inline std::unique_ptr<slice_source> open_source(const std::filesystem::path &p) {
+                std::unique_ptr<slice_source> source;
+                if (std::filesystem::is_directory(p)) {
+                        source = std::make_unique<files_source>(p);
+                } else if (p.extension() == ".tif" || p.extension() == ".tiff") {
+                        source = std::make_unique<tiff_source>(p);
+                } else if (p.extension() == ".nrrd" || p.extension() == ".nhdr") {
+                        source = std::make_unique<raw_source>(p);
+                } else {
+                        throw std::runtime_error("Unsupported format");
+                }
+                if (source->size() == 0) {
+                        throw std::runtime_error("Empty images");
+                }
+                return source;
+        }
+
+        void get_volume_size(const slice_source &source, uint32_t &sx, uint32_t &sy, uint32_t &sz, int &type) {
+                cv::Mat image = source.read(0);
+                if (image.empty()) {
+                        throw std::runtime_error(source.name(0) + " cannot be read.");
+                }
+                sx = uint32_t(image.size().width);
+                sy = uint32_t(image.size().height);
+                sz = source.size();
+                type = image.type();
+        }
+
+        void get_volume_size(const slice_source &source, uint32_t &sx, uint32_t &sy, uint32_t &sz) {
+                int type;
+                xyz2zxy::get_volume_size(source, sx, sy, sz, type);
+        }
+
+        /**
+         * @brief Sub-box of a source. Only the slices in the box are read, and only the region of each slice is kept.
+         */
+        class roi_source : public slice_source {
+        private:
+                const slice_source &source_;
+                region roi_;
+        public:
+                /**
+                 * @throw runtime_error if the region is empty or out of the volume.
+                 */
+                roi_source(const slice_source &source, const region &roi) : source_(source), roi_(roi) {
+                        uint32_t sx, sy, sz;
+                        xyz2zxy::get_volume_size(source, sx, sy, sz);
+                        if (roi.is_empty() || uint64_t(roi.x) + roi.width > sx || uint64_t(roi.y) + roi.height > sy || uint64_t(roi.z) + roi.depth > sz) {
+                                throw std::runtime_error("The ROI is out of the volume (" + std::to_string(sx) + "x" + std::to_string(sy) + "x" + std::to_string(sz) + ").");
+                        }
+                }
+
+                [[nodiscard]] uint32_t size() const override {
+                        return this->roi_.depth;
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z) const override {
+                        return this->source_.read(this->roi_.z + z, this->roi_.rect());
+                }
+
+                [[nodiscard]] cv::Mat read(const uint32_t z, const cv::Rect &rect) const override {
+                        return this->source_.read(this->roi_.z + z, rect + this->roi_.rect().tl());
+                }
+
+                [[nodiscard]] bool is_partial() const override {
+                        return this->source_.is_partial();
+                }
+
+                void will_need(const uint32_t begin, const uint32_t end) const override {
+                        this->source_.will_need(this->roi_.z + begin, this->roi_.z + end);
+                }
+
+                void drop(const uint32_t begin, const uint32_t end) const override {
+                        this->source_.drop(this->roi_.z + begin, this->roi_.z + end);
+                }
+
+                [[nodiscard]] std::string name(const uint32_t z) const override {
+                        return this->source_.name(this->roi_.z + z);
+                }
+        };
+
+        /**
+         * @brief Read images [begin, end) in parallel.
+         * @param rect Region of the slices. Empty : whole slices.
+         * @param size Size of whole slices (i.e., of slice 0). Empty : the size of the first image read.
+         * @param type Type of the slices (i.e., of slice 0). -1 : the type of the first image read.
+         * @throw runtime_error if an image cannot be read or differs from slice 0 in the size or the type.
+         */
+        inline std::vector<cv::Mat> read_images(const slice_source &source, const uint32_t begin, const uint32_t end, mi::thread_pool &pool, statistics *stats = nullptr, const cv::Rect &rect = cv::Rect(),
+                                                cv::Size size = cv::Size(), int type = -1) {
+                std::vector<cv::Mat> images(end - begin);
+                auto read = [&source, &rect](const uint32_t z) { return rect.area() == 0 ? source.read(z) : source.read(z, rect); };
+                pool.parallel_for(images.size(), [&images, &read, &begin, &stats](const size_t i) {
+                        if (stats == nullptr) {
+                                images[i] = read(begin + uint32_t(i));
+                                return;
+                        }
+                        statistics::scoped_timer timer(stats->decode_ns);
+                        images[i] = read(begin + uint32_t(i));
+                        stats->input_bytes += images[i].total() * images[i].elemSize();
+                });
+                if (auto it = std::find_if(images.begin(), images.end(), [](auto &image) { return image.empty(); }); it != images.end()) {
+                        throw std::runtime_error(source.name(begin + uint32_t(it - images.begin())) + " cannot be read.");
+                }
+                if (images.empty()) {
+                        return images;
+                }
+                if (size.empty()) {
+                        size = images.front().size();
+                } else if (rect.area() > 0) {
+                        size = rect.size();
+                }
+                if (type < 0) {
+                        type = images.front().type();
+                }
+                // the kernels walk the slices with the stride of slice 0.
+                if (auto it = std::find_if(images.begin(), images.end(), [&size, &type](auto &image) { return image.size() != size || image.type() != type; }); it != images.end()) {
+                        throw std::runtime_error(source.name(begin + uint32_t(it - images.begin())) + " differs from " + source.name(0) + " in the size or the type.");
+                }
+                return images;
+        }
+
+        /**
+         * @brief Slices [begin, end) read at once.
+         */
+        struct chunk_range {
+                uint32_t begin = 0, end = 0;
+                cv::Rect rect; ///< region of the slices (a row band). Empty : whole slices.
+        };
+
+        /**
+         * @brief Ranges of all chunks of whole slices.
+         */
+        inline std::vector<chunk_range> chunk_ranges(const uint32_t sz, const uint32_t step) {
+                std::vector<chunk_range> ranges;
+                for (uint32_t z = 0; z < sz; z += step) {
+                        ranges.push_back(chunk_range{z, std::min(z + step, sz), cv::Rect()});
+                }
+                return ranges;
+        }
+
+        /**
+         * @brief Read chunks of slices ahead in the background while the current chunk is processed.
+         */
+        class chunk_prefetcher {
+        private:
+                const slice_source &source_;
+                std::vector<chunk_range> ranges_;
+                cv::Size size_; ///< size of whole slices
+                int type_;
+                uint32_t depth_;
+                size_t next_; ///< the chunk read next
+                mi::thread_pool &pool_;
+                statistics *stats_;
+                mi::cache_policy cache_;
+                size_t hinted_; ///< the chunk hinted next
+                size_t returned_; ///< the number of chunks returned
+                std::deque<std::future<std::vector<cv::Mat>>> queue_;
+
+                void fill() {
+                        for (; this->queue_.size() < this->depth_ && this->next_ < this->ranges_.size(); ++this->next_) {
+                                const chunk_range &c = this->ranges_[this->next_];
+                                this->queue_.push_back(std::async(std::launch::async, &xyz2zxy::read_images, std::cref(this->source_), c.begin, c.end, std::ref(this->pool_), this->stats_, c.rect, this->size_, this->type_));
+                        }
+                        // the chunk after those being decoded is read ahead by the kernel meanwhile. Bands of the same slices are hinted once.
+                        for (; this->cache_ != mi::cache_policy::keep && this->hinted_ <= this->next_ && this->hinted_ < this->ranges_.size(); ++this->hinted_) {
+                                if (this->hinted_ == 0 || this->ranges_[this->hinted_ - 1].begin != this->ranges_[this->hinted_].begin) {
+                                        this->source_.will_need(this->ranges_[this->hinted_].begin, this->ranges_[this->hinted_].end);
+                                }
+                        }
+                }
+
+                // drop the slices of the chunk i unless the following bands read them.
+                void drop(const size_t i) const {
+                        if (this->cache_ != mi::cache_policy::keep && (i + 1 == this->ranges_.size() || this->ranges_[i + 1].begin != this->ranges_[i].begin)) {
+                                this->source_.drop(this->ranges_[i].begin, this->ranges_[i].end);
+                        }
+                }
+
+        public:
+                /**
+                 * @param ranges Chunks in the order of reading (e.g., chunk_ranges()).
+                 * @param size Size of whole slices (i.e., of slice 0). A slice of another size fails next().
+                 * @param type Type of the slices (i.e., of slice 0). A slice of another type fails next().
+                 * @param depth The number of chunks being read ahead. 0 reads a chunk when it is requested.
+                 * @param pool Threads decoding the slices. Chunks read ahead share the pool with the caller.
+                 * @param stats Counters of decoding (optional).
+                 * @param cache Use of the page cache. Except for keep, the slices are hinted before they are read and dropped after the chunk is processed.
+                 */
+                chunk_prefetcher(const slice_source &source, std::vector<chunk_range> ranges, const cv::Size size, const int type, const uint32_t depth, mi::thread_pool &pool,
+                                 statistics *stats = nullptr, const mi::cache_policy cache = mi::cache_policy::keep)
+                        : source_(source), ranges_(std::move(ranges)), size_(size), type_(type), depth_(depth), next_(0), pool_(pool), stats_(stats), cache_(cache), hinted_(0), returned_(0) {
+                        this->fill();
+                }
+
+                chunk_prefetcher(const chunk_prefetcher &that) = delete;
+
+                chunk_prefetcher &operator=(const chunk_prefetcher &that) = delete;
+
+                ~chunk_prefetcher() {
+                        this->queue_.clear(); // wait for the chunks being read
+                        if (this->returned_ > 0) {
+                                this->drop(this->returned_ - 1);
+                        }
+                }
+
+                /**
+                 * @brief Get the next chunk and start reading the one after.
+                 * @note The chunk returned before is regarded as processed.
+                 * @throw runtime_error if an image cannot be read or differs from slice 0 in the size or the type.
+                 */
+                std::vector<cv::Mat> next() {
+                        if (this->returned_ > 0) {
+                                this->drop(this->returned_ - 1);
+                        }
+                        ++this->returned_;
+                        if (this->queue_.empty()) { // no prefetching
+                                const chunk_range &c = this->ranges_.at(this->next_++);
+                                this->fill();
+                                return xyz2zxy::read_images(this->source_, c.begin, c.end, this->pool_, this->stats_, c.rect, this->size_, this->type_);
+                        }
+                        std::future<std::vector<cv::Mat>> f = std::move(this->queue_.front());
+                        this->queue_.pop_front();
+                        this->fill();
+                        return f.get();
+                }
+        };
+
+        /**
+         * @brief Output planes.
+         * @note write() is called from multiple threads in any order.
+         */
+        class slice_sink {
+        protected:
+                std::atomic<uint64_t> bytes_{0}; ///< bytes written to files.
+                std::atomic<uint64_t> files_{0}; ///< files created.
+        public:
+                virtual ~slice_sink() = default;
+
+                [[nodiscard]] uint64_t bytes_written() const {
+                        return this->bytes_;
+                }
+
+                [[nodiscard]] uint64_t files_created() const {
+                        return this->files_;
+                }
+
+                /**
+                 * @brief Called before the planes are written.
+                 * @param planes The number of planes.
+                 */
+                virtual void open([[maybe_unused]] uint32_t planes) {}
+
+                /**
+                 * @brief Write the plane u.
+                 * @return false if the plane cannot be written.
+                 */
+                virtual bool write(uint32_t u, const cv::Mat &image) = 0;
+
+                /**
+                 * @brief Called when a plane will not be written (e.g., its reading failed), so that writers waiting for it return.
+                 */
+                virtual void cancel() {}
+
+                /**
+                 * @brief Finish writing.
+                 * @throw runtime_error if some planes are not written.
+                 */
+                virtual void close() {}
+
+                /**
+                 * @brief Size of the plane u in the output, used to check planes finished before a resumed run.
+                 * @return 0 if the plane is not written or the sink cannot tell (planes are always written again).
+                 */
+                [[nodiscard]] virtual uint64_t size_of([[maybe_unused]] uint32_t u) const {
+                        return 0;
+                }
+
+                /**
+                 * @brief Edge of the 3D blocks taken by write_block(). 0 : the sink takes planes.
+                 */
+                [[nodiscard]] virtual uint32_t block_size() const {
+                        return 0;
+                }
+
+                /**
+                 * @brief Called before the blocks are written.
+                 * @param cols, rows, planes Size of the output volume.
+                 */
+                virtual void open_blocks([[maybe_unused]] uint32_t cols, [[maybe_unused]] uint32_t rows, [[maybe_unused]] uint32_t planes, [[maybe_unused]] int type) {}
+
+                /**
+                 * @brief Write the block (i, j, k), the indices along columns, rows and planes.
+                 * @param size Columns, rows and planes of the block (clipped at the end of the volume).
+                 * @param data Voxels in the order of planes, rows and columns.
+                 * @return false if the block cannot be written.
+                 */
+                virtual bool write_block([[maybe_unused]] uint32_t i, [[maybe_unused]] uint32_t j, [[maybe_unused]] uint32_t k, [[maybe_unused]] const std::array<uint32_t, 3> &size,
+                                         [[maybe_unused]] const std::vector<uint8_t> &data) {
+                        return false;
+                }
+        };
+
+        /**
+         * @brief Planes written as image files (image-XXXXX{ext}) in a directory.
+         */
+        class files_sink : public slice_sink {
+        private:
+                std::filesystem::path dir_;
+                std::filesystem::path extension_;
+                std::vector<int> params_;
+                mi::cache_policy cache_;
+        public:
+                /**
+                 * @param cache Use of the page cache. Except for keep, files are written through and dropped from the cache, so that dirty pages do not pile up.
+                 */
+                files_sink(const std::filesystem::path &dir, const std::filesystem::path &extension, const std::vector<int> &params, const mi::cache_policy cache = mi::cache_policy::keep)
+                        : dir_(dir), extension_(extension), params_(params), cache_(cache) {
+                        xyz2zxy::create_directory(dir);
+                }
+
+                [[nodiscard]] std::string filename(const uint32_t u) const {
+                        std::stringstream ss;
+                        ss << this->dir_.string() << "/" << "image-" << std::setw(5) << std::setfill('0') << u << this->extension_.string();
+                        return ss.str();
+                }
+
+                bool write(const uint32_t u, const cv::Mat &image) override {
+                        const std::string filename = this->filename(u);
+                        if (!xyz2zxy::write_image(filename, image, this->params_)) {
+                                return false;
+                        }
+                        if (this->cache_ != mi::cache_policy::keep) {
+                                mi::drop_cache(filename, true);
+                        }
+                        if (const uint64_t bytes = this->size_of(u); bytes > 0) {
+                                this->bytes_ += bytes;
+                                ++this->files_;
+                        }
+                        return true;
+                }
+
+                [[nodiscard]] uint64_t size_of(const uint32_t u) const override {
+                        const std::string filename = this->filename(u);
+                        std::error_code ec;
+                        return std::filesystem::exists(filename, ec) ? uint64_t(std::filesystem::file_size(filename, ec)) : 0;
+                }
+        };
+
+        /**
+         * @brief Planes written as pages of a single BigTIFF.
+         * @note Pages are encoded by the callers in parallel and appended in plane order.
+         * Pages finished out of order wait in the buffer until the preceding ones are appended.
+         * Callers far ahead of the plane appended next wait before encoding, so that the buffer is bounded.
+         */
+        class tiff_stack_sink : public slice_sink {
+        private:
+                std::filesystem::path path_;
+                std::ofstream out_;
+                std::unique_ptr<mi::tiff_writer> writer_;
+                std::vector<int> params_;
+                uint32_t planes_;
+                uint32_t next_; ///< the plane appended next
+                uint32_t window_; ///< planes encoded ahead of next_
+                std::map<uint32_t, std::vector<uint8_t>> pending_;
+                bool is_failed_;
+                std::mutex mtx_;
+                std::condition_variable cv_; ///< notified when next_ advances or the writing fails
+
+                // the pages buffered are never appended after a failure (mtx_ must be locked).
+                void fail() {
+                        this->is_failed_ = true;
+                        this->pending_.clear();
+                        this->cv_.notify_all();
+                }
+
+                void append(const std::vector<uint8_t> &buffer) {
+                        mi::tiff_reader page(buffer.data(), buffer.size());
+                        if (!this->writer_) { // byte order follows the encoder
+                                this->writer_ = std::make_unique<mi::tiff_writer>(this->out_, true, page.byte_order());
+                        }
+                        this->writer_->append(page.page(0).entries(), page.chunks(0), page.page(0).is_tiled());
+                }
+
+        public:
+                /**
+                 * @param threads The number of threads writing the planes. Up to twice as many pages are buffered.
+                 * @throw runtime_error if the file cannot be created.
+                 */
+                tiff_stack_sink(const std::filesystem::path &path, const std::vector<int> &params, const uint32_t threads = std::thread::hardware_concurrency())
+                        : path_(path), params_(params), planes_(0), next_(0), window_(2 * std::max(threads, 1u)), is_failed_(false) {
+                        if (path.has_parent_path()) {
+                                xyz2zxy::create_directory(path.parent_path());
+                        }
+                        this->out_.open(path, std::ios::binary);
+                        if (!this->out_) {
+                                throw std::runtime_error(path.string() + " cannot be opened.");
+                        }
+                        ++this->files_;
+                }
+
+                void open(const uint32_t planes) override {
+                        this->planes_ = planes;
+                }
+
+                bool write(const uint32_t u, const cv::Mat &image) override {
+                        {
+                                std::unique_lock<std::mutex> lock(this->mtx_);
+                                this->cv_.wait(lock, [this, u]() { return u < this->next_ + this->window_ || this->is_failed_; });
+                                if (this->is_failed_) {
+                                        return false;
+                                }
+                        }
+                        std::vector<uint8_t> buffer;
+                        const bool is_encoded = (image.depth() <= 2) && cv::imencode(".tif", image, buffer, this->params_);
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        if (!is_encoded || this->is_failed_) {
+                                this->fail();
+                                return false;
+                        }
+                        this->pending_.emplace(u, std::move(buffer));
+                        const uint32_t next = this->next_;
+                        for (auto it = this->pending_.find(this->next_); it != this->pending_.end(); it = this->pending_.find(this->next_)) {
+                                try {
+                                        this->append(it->second);
+                                } catch (std::exception &) {
+                                        this->fail();
+                                        return false;
+                                }
+                                this->bytes_ += it->second.size();
+                                this->pending_.erase(it);
+                                ++this->next_;
+                        }
+                        if (this->next_ != next) {
+                                this->cv_.notify_all();
+                        }
+                        return true;
+                }
+
+                void cancel() override {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        this->fail();
+                }
+
+                void close() override {
+                        std::lock_guard<std::mutex> lock(this->mtx_);
+                        this->writer_.reset();
+                        this->out_.close();
+                        if (this->is_failed_ || this->next_ != this->planes_ || !this->out_) {
+                                throw std::runtime_error(this->path_.string() + " cannot be written.");
+                        }
+                }
+        };
+
+        /**
+         * @brief Planes passed to a function.
+         * @note The function is called from multiple threads in any order. The image is valid only during the call.
+         */
+        class callback_sink : public slice_sink {
+        public:
+                using callback = std::function<bool(uint32_t, const cv::Mat &)>;
+        private:
+                callback fn_;
+                std::atomic<bool> is_failed_;
+        public:
+                explicit callback_sink(callback fn) : fn_(std::move(fn)), is_failed_(false) {}
+
+                bool write(const uint32_t u, const cv::Mat &image) override {
+                        if (!this->fn_(u, image)) {
+                                this->is_failed_ = true;
+                                return false;
+                        }
+                        return true;
+                }
+
+                void close() override {
+                        if (this->is_failed_) {
+                                throw std::runtime_error("Some planes were rejected by the callback.");
+                        }
+                }
+        };
+
+        /**
+         * @brief Output volume written as a Zarr (v2) array of 3D blocks, i.e., a directory of .zarray and a file per block ({k}/{j}/{i}).
+         * @note The array has the shape (planes, rows, columns[, channels]). Blocks at the end of the volume are padded with 0.
+         * Blocks are compressed by zlib when it is available. A block can be read without reading the planes.
+         */
+        class zarr_sink : public slice_sink {
+        private:
+                std::filesystem::path dir_;
+                uint32_t block_;
+                int level_; ///< zlib compression level. 0 : no compression.
+                int type_;
+                mi::cache_policy cache_;
+
+                [[nodiscard]] bool is_compressed() const {
+#if defined(XYZ2ZXY_WITH_ZLIB)
+                        return this->level_ > 0;
+#else
+                        return false;
+#endif
+                }
+
+                [[nodiscard]] std::string dtype() const {
+                        const std::string order = (CV_ELEM_SIZE1(this->type_) == 1) ? "|" : (std::endian::native == std::endian::little) ? "<" : ">";
+                        switch (CV_MAT_DEPTH(this->type_)) {
+                                case CV_8U:
+                                        return order + "u1";
+                                case CV_8S:
+                                        return order + "i1";
+                                case CV_16U:
+                                        return order + "u2";
+                                case CV_16S:
+                                        return order + "i2";
+                                case CV_32S:
+                                        return order + "i4";
+                                case CV_32F:
+                                        return order + "f4";
+                                default:
+                                        return order + "f8";
+                        }
+                }
+
+                void save(const std::filesystem::path &filename, const std::string &str) {
+                        std::ofstream fout(filename);
+                        fout << str << std::endl;
+                        if (!fout) {
+                                throw std::runtime_error(filename.string() + " cannot be written.");
+                        }
+                        this->bytes_ += str.size() + 1;
+                        ++this->files_;
+                }
+
+        public:
+                /**
+                 * @param block Edge of the blocks.
+                 * @param level Compression level of zlib (1 - 9). 0 : no compression.
+                 * @param cache Use of the page cache. Except for keep, blocks are written through and dropped from the cache.
+                 */
+                zarr_sink(const std::filesystem::path &dir, const uint32_t block, const int level = 1, const mi::cache_policy cache = mi::cache_policy::keep)
+                        : dir_(dir), block_(block), level_(level), type_(CV_8UC1), cache_(cache) {}
+
+                [[nodiscard]] uint32_t block_size() const override {
+                        return this->block_;
+                }
+
+                bool write([[maybe_unused]] const uint32_t u, [[maybe_unused]] const cv::Mat &image) override {
+                        return false; // blocks only
+                }
+
+                /**
+                 * @throw runtime_error if the metadata cannot be written.
+                 */
+                void open_blocks(const uint32_t cols, const uint32_t rows, const uint32_t planes, const int type) override {
+                        this->type_ = type;
+                        xyz2zxy::create_directory(this->dir_);
+                        const int channels = CV_MAT_CN(type);
+                        const std::string ch = (channels > 1) ? ", " + std::to_string(channels) : "";
+                        std::stringstream ss;
+                        ss << "{\n"
+                           << "  \"zarr_format\": 2,\n"
+                           << "  \"shape\": [" << planes << ", " << rows << ", " << cols << ch << "],\n"
+                           << "  \"chunks\": [" << this->block_ << ", " << this->block_ << ", " << this->block_ << ch << "],\n"
+                           << "  \"dtype\": " << mi::json_string(this->dtype()) << ",\n"
+                           << "  \"compressor\": " << (this->is_compressed() ? "{\"id\": \"zlib\", \"level\": " + std::to_string(this->level_) + "}" : std::string("null")) << ",\n"
+                           << "  \"fill_value\": 0,\n"
+                           << "  \"order\": \"C\",\n"
+                           << "  \"filters\": null,\n"
+                           << "  \"dimension_separator\": \"/\"\n"
+                           << "}";
+                        this->save(this->dir_ / ".zarray", ss.str());
+                }
+
+                bool write_block(const uint32_t i, const uint32_t j, const uint32_t k, const std::array<uint32_t, 3> &size, const std::vector<uint8_t> &data) override {
+                        const size_t pixel = CV_ELEM_SIZE(this->type_);
+                        const size_t b = this->block_;
+                        std::vector<uint8_t> padded;
+                        const std::vector<uint8_t> *block = &data;
+                        if (size[0] != b || size[1] != b || size[2] != b) {
+                                padded.assign(b * b * b * pixel, 0);
+                                for (size_t z = 0; z < size[2]; ++z) {
+                                        for (size_t y = 0; y < size[1]; ++y) {
+                                                std::memcpy(padded.data() + (z * b + y) * b * pixel, data.data() + (z * size[1] + y) * size[0] * pixel, size[0] * pixel);
+                                        }
+                                }
+                                block = &padded;
+                        }
+#if defined(XYZ2ZXY_WITH_ZLIB)
+                        std::vector<uint8_t> compressed;
+                        if (this->is_compressed()) {
+                                uLongf bytes = compressBound(uLong(block->size()));
+                                compressed.resize(bytes);
+                                if (compress2(compressed.data(), &bytes, block->data(), uLong(block->size()), this->level_) != Z_OK) {
+                                        return false;
+                                }
+                                compressed.resize(bytes);
+                                block = &compressed;
+                        }
+#endif
+                        std::filesystem::path filename = this->dir_ / std::to_string(k) / std::to_string(j) / std::to_string(i);
+                        if (CV_MAT_CN(this->type_) > 1) {
+                                filename /= "0";
+                        }
+                        std::error_code ec;
+                        std::filesystem::create_directories(filename.parent_path(), ec); // may be created by another thread
+                        std::ofstream fout(filename, std::ios::binary);
+                        fout.write(reinterpret_cast<const char *>(block->data()), std::streamsize(block->size()));
+                        fout.close();
+                        if (!fout) {
+                                return false;
+                        }
+                        if (this->cache_ != mi::cache_policy::keep) {
+                                mi::drop_cache(filename, true);
+                        }
+                        this->bytes_ += block->size();
+                        ++this->files_;
+                        return true;
+                }
+        };
+
+        /**
+         * @brief Planes written with downsampled levels.
+         * @note The plane u of a level is the 2x2x2 box average of the planes 2u and 2u + 1 of the level above,
+         * so that the levels are built from the planes being written instead of reading the output again.
+         * 2x2 sums of a plane wait in the level until the other plane of the pair is written (pairs are usually written close together).
+         * The last row, column and plane are repeated when the size is odd.
+         */
+        class pyramid_sink : public slice_sink {
+        private:
+                struct level {
+                        std::unique_ptr<slice_sink> sink;
+                        uint32_t planes = 0;
+                        std::map<uint32_t, cv::Mat> pending; ///< 2x2 sums of a plane of the pair
+                        std::mutex mtx;
+                };
+                std::unique_ptr<slice_sink> base_;
+                std::vector<std::unique_ptr<level>> levels_;
+                uint32_t planes_;
+
+                // add the plane u of the level above levels_[l].
+                void add(const size_t l, const uint32_t u, const cv::Mat &image) {
+                        if (image.depth() != CV_8U && image.depth() != CV_16U) {
+                                throw std::runtime_error("The pyramid supports 8-bit and 16-bit images only.");
+                        }
+                        level &lv = *this->levels_[l];
+                        const uint32_t planes = (l == 0) ? this->planes_ : this->levels_[l - 1]->planes;
+                        cv::Mat sum((image.rows + 1) / 2, (image.cols + 1) / 2, CV_32SC(image.channels()));
+                        const auto box_sum = (image.depth() == CV_8U) ? mi::box_sum_2x2<uint8_t> : mi::box_sum_2x2<uint16_t>;
+                        box_sum(image.data, image.step[0], image.cols, image.rows, image.channels(), sum.ptr<int32_t>(), sum.step[0] / sizeof(int32_t));
+                        double scale = 1.0 / 8;
+                        if (const uint32_t v = u / 2; 2 * v + 1 < planes) {
+                                cv::Mat other;
+                                {
+                                        std::lock_guard<std::mutex> lock(lv.mtx);
+                                        if (auto it = lv.pending.find(v); it == lv.pending.end()) {
+                                                lv.pending.emplace(v, std::move(sum));
+                                                return;
+                                        } else {
+                                                other = std::move(it->second);
+                                                lv.pending.erase(it);
+                                        }
+                                }
+                                cv::add(sum, other, sum);
+                        } else {
+                                scale = 2.0 / 8; // the last plane is repeated
+                        }
+                        cv::Mat plane;
+                        sum.convertTo(plane, image.type(), scale);
+                        if (!lv.sink->write(u / 2, plane)) {
+                                throw std::runtime_error("A plane of the pyramid cannot be written.");
+                        }
+                        if (l + 1 < this->levels_.size()) {
+                                this->add(l + 1, u / 2, plane);
+                        }
+                }
+
+        public:
+                /**
+                 * @param levels Sinks of the levels from 2x.
+                 */
+                pyramid_sink(std::unique_ptr<slice_sink> base, std::vector<std::unique_ptr<slice_sink>> levels) : base_(std::move(base)), planes_(0) {
+                        for (auto &sink: levels) {
+                                this->levels_.emplace_back(std::make_unique<level>());
+                                this->levels_.back()->sink = std::move(sink);
+                        }
+                }
+
+                void open(const uint32_t planes) override {
+                        this->planes_ = planes;
+                        this->base_->open(planes);
+                        uint32_t n = planes;
+                        for (auto &lv: this->levels_) {
+                                n = (n + 1) / 2;
+                                lv->planes = n;
+                                lv->sink->open(n);
+                        }
+                }
+
+                void cancel() override {
+                        this->base_->cancel();
+                        for (auto &lv: this->levels_) {
+                                lv->sink->cancel();
+                        }
+                }
+
+                bool write(const uint32_t u, const cv::Mat &image) override {
+                        const bool is_written = this->base_->write(u, image);
+                        if (!this->levels_.empty()) {
+                                this->add(0, u, image);
+                        }
+                        return is_written;
+                }
+
+                void close() override {
+                        this->base_->close();
+                        this->bytes_ = this->base_->bytes_written();
+                        this->files_ = this->base_->files_created();
+                        for (auto &lv: this->levels_) {
+                                lv->sink->close();
+                                if (!lv->pending.empty()) {
+                                        throw std::runtime_error("Some planes of the pyramid are not written.");
+                                }
+                                this->bytes_ += lv->sink->bytes_written();
+                                this->files_ += lv->sink->files_created();
+                        }
+                }
+
+                /**
+                 * @return 0, so that the planes are always written again since the levels are built from them.
+                 */
+                [[nodiscard]] uint64_t size_of([[maybe_unused]] const uint32_t u) const override {
+                        return 0;
+                }
+        };
+
+        /**
+         * @brief Path of the level downsampled by 2^level ({output}_2x, or {stem}_2x{ext} for a BigTIFF).
+         */
+        inline std::filesystem::path pyramid_path(std::filesystem::path p, const int level) {
+                const std::string suffix = "_" + std::to_string(1 << level) + "x";
+                if (!p.has_filename()) { // trailing separator
+                        p = p.parent_path();
+                }
+                if (xyz2zxy::is_stack_path(p)) {
+                        return p.parent_path() / (p.stem().string() + suffix + p.extension().string());
+                }
+                return p.string() + suffix;
+        }
+
+        /**
+         * @brief The number of worker threads.
+         * @param threads Requested number of threads. 0 : the number of hardware threads.
+         */
+        inline uint32_t worker_count(const int threads) {
+                return threads > 0 ? uint32_t(threads) : std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        /**
+         * @brief Open the output. A single BigTIFF is written when the path ends with .tif, .tiff or .btf.
+         * @param threads The number of threads writing the planes.
+         */
+        inline std::unique_ptr<slice_sink> open_sink(const std::filesystem::path &p, const std::filesystem::path &extension, const std::vector<int> &params, const mi::cache_policy cache = mi::cache_policy::keep,
+                                                     const uint32_t threads = std::thread::hardware_concurrency()) {
+                if (xyz2zxy::is_stack_path(p)) {
+                        return std::make_unique<tiff_stack_sink>(p, params, threads);
+                }
+                return std::make_unique<files_sink>(p, extension, params, cache);
+        }
+
+        /**
+         * @brief Open the output of the options. A chunked array of options::block is written when the path ends with .zarr.
+         * The levels of options::pyramid are written beside the output in the same form.
+         * @throw runtime_error if the pyramid is requested for the chunked output.
+         */
+        inline std::unique_ptr<slice_sink> open_sink(const std::filesystem::path &p, const options &opt) {
+                if (p.extension() == ".zarr") {
+                        if (opt.pyramid > 0) {
+                                throw std::runtime_error("--pyramid is not supported for the chunked output.");
+                        }
+                        if (opt.compress != "" && opt.compress != "none" && opt.compress != "deflate") {
+                                throw std::runtime_error("The chunked output supports none and deflate (zlib) only.");
+                        }
+                        return std::make_unique<zarr_sink>(p, uint32_t(opt.block), (opt.compress == "none") ? 0 : (opt.level >= 0) ? opt.level : 1, xyz2zxy::cache_policy(opt.cache));
+                }
+                const uint32_t threads = xyz2zxy::worker_count(opt.threads);
+                if (opt.pyramid > 0) {
+                        std::vector<std::unique_ptr<slice_sink>> levels;
+                        for (int l = 1; l <= opt.pyramid; ++l) {
+                                levels.emplace_back(xyz2zxy::open_sink(xyz2zxy::pyramid_path(p, l), opt.extension, opt.params, xyz2zxy::cache_policy(opt.cache), threads));
+                        }
+                        return std::make_unique<pyramid_sink>(xyz2zxy::open_sink(p, opt.extension, opt.params, xyz2zxy::cache_policy(opt.cache), threads), std::move(levels));
+                }
+                return xyz2zxy::open_sink(p, opt.extension, opt.params, xyz2zxy::cache_policy(opt.cache), threads);
+        }
+
+        /**
+         * @brief Open the progress of the options on stderr. Bars are updated 4 times a second, and JSON lines are written every 5 seconds.
+         * @return nullptr if the progress is not shown.
+         */
+        inline std::unique_ptr<mi::progress_tracker> open_progress(const options &opt) {
+                if (!opt.is_verbose || opt.progress == "none") {
+                        return nullptr;
+                }
+                if (opt.progress == "json" || (opt.progress == "auto" && !mi::progress_tracker::is_terminal())) {
+                        return std::make_unique<mi::progress_tracker>(std::cerr, mi::progress_tracker::style::json, std::chrono::milliseconds(5000));
+                }
+                return std::make_unique<mi::progress_tracker>(std::cerr, mi::progress_tracker::style::bar, std::chrono::milliseconds(250));
+        }
+
+        /**
+         * @brief Check whether all slices and the output planes under construction fit in the budget.
+         * @note Each worker holds a plane.
+         */
+        inline bool fits_in_memory(const uint32_t sx, const uint32_t sy, const uint32_t sz, const int type, const size_t budget, const uint32_t threads = std::thread::hardware_concurrency()) {
+                const size_t pixel = CV_ELEM_SIZE(type);
+                const size_t volume = size_t(sx) * sy * sz * pixel;
+                const size_t planes = size_t(std::max(sx, sy)) * sz * pixel * threads;
+                return volume + planes < budget;
+        }
+
+        /**
+         * @brief The number of slices loaded at once in Step1.
+         * @param width Width of a strip (sx for xyz2zxy, sy for xyz2yzx).
+         * @param chunks The number of chunks in memory at once (the current one and the prefetched ones).
+         * @note Each worker holds up to two strips besides the slices.
+         */
+        inline int chunk_size(const uint32_t sx, const uint32_t sy, const uint32_t sz, const int type, const uint32_t width, const size_t budget, const uint32_t chunks = 1, const uint32_t threads = std::thread::hardware_concurrency()) {
+                const size_t pixel = CV_ELEM_SIZE(type);
+                const size_t per_slice = chunks * size_t(sx) * sy * pixel + 2 * size_t(width) * pixel * threads;
+                return int(std::clamp<size_t>(budget / per_slice, 1, sz));
+        }
+
+        /**
+         * @brief The number of rows of the slices loaded at once in Step1 when the slices are read by row bands.
+         * @param step The number of slices in a chunk.
+         * @param chunks The number of chunks in memory at once (the current one and the prefetched ones).
+         * @note Each worker holds up to two strips of step rows besides the bands.
+         */
+        inline uint32_t band_rows(const uint32_t sx, const uint32_t sy, const int type, const uint32_t step, const size_t budget, const uint32_t chunks = 1, const uint32_t threads = std::thread::hardware_concurrency()) {
+                const size_t pixel = CV_ELEM_SIZE(type);
+                const size_t strips = 2 * size_t(sx) * step * pixel * threads;
+                const size_t per_row = chunks * size_t(sx) * step * pixel;
+                return uint32_t(std::clamp<size_t>(budget > strips ? (budget - strips) / per_row : 0, 1, sy));
+        }
+
+        /**
+         * @brief The number of workers in Step2.
+         * @param width Width of a strip (sx for xyz2zxy, sy for xyz2yzx).
+         * @note Each worker holds two copies of a plane (strips read from the scratch and the transposed one).
+         */
+        inline uint32_t concurrency(const uint32_t sz, const int type, const uint32_t width, const size_t budget, const uint32_t threads = std::thread::hardware_concurrency()) {
+                const size_t per_worker = 2 * size_t(width) * sz * CV_ELEM_SIZE(type);
+                return uint32_t(std::clamp<size_t>(budget / per_worker, 1, threads));
+        }
+
+        /**
+         * @brief Fan-ins of the levels merging the strips of the files scratch before Step2.
+         * @param fan_in The number of strips of a plane.
+         * @param max_fan_in The number of strips of a plane read in Step2 at most. A merged strip is built from as many strips at most.
+         * @param strip_bytes Size of a strip.
+         * @param budget Memory of a worker. A merged strip must fit in it.
+         * @return Empty if the strips are not merged.
+         * @note The levels are as few as possible and their fan-ins are balanced. Levels exceeding the budget are dropped, so that Step2 may read more strips.
+         */
+        inline std::vector<uint32_t> merge_levels(const uint32_t fan_in, const uint32_t max_fan_in, const size_t strip_bytes, const size_t budget) {
+                std::vector<uint32_t> fans;
+                if (max_fan_in < 2 || fan_in <= max_fan_in) {
+                        return fans;
+                }
+                uint32_t levels = 1;
+                for (uint64_t n = uint64_t(max_fan_in) * max_fan_in; n < fan_in; n *= max_fan_in) {
+                        ++levels;
+                }
+                auto remaining = [fan_in, levels](const uint32_t fan) { // strips of a plane after the levels
+                        uint64_t n = fan_in;
+                        for (uint32_t l = 0; l < levels; ++l) {
+                                n = (n + fan - 1) / fan;
+                        }
+                        return n;
+                };
+                uint32_t fan = 2;
+                while (remaining(fan) > max_fan_in) {
+                        ++fan;
+                }
+                size_t bytes = strip_bytes;
+                for (uint32_t l = 0; l < levels && bytes * fan <= budget; ++l) {
+                        fans.push_back(fan);
+                        bytes *= fan;
+                }
+                return fans;
+        }
+
+        /**
+         * @brief The number of output planes, i.e., the size along the slice axis of the order.
+         */
+        inline uint32_t output_planes(const std::string &order, const uint32_t sx, const uint32_t sy, const uint32_t sz) {
+                return order.back() == 'x' ? sx : order.back() == 'y' ? sy : sz;
+        }
+
+        namespace detail {
+                /**
+                 * @brief Reslice the volume along the axis Slice.
+                 * @tparam Slice Slice axis of the output ('x', 'y' or 'z').
+                 * @tparam Transposed Whether the output plane is the transpose of the stacked strips (yzx, zxy and yxz).
+                 * @note Strips are rows (Slice = y) or columns (Slice = x) of the slices. Slice = z converts each slice independently.
+                 */
+                template<char Slice, bool Transposed>
+                void reslice(const slice_source &source, slice_sink &sink, const options &opt, statistics &stats) {
+                        uint32_t sx, sy, sz;
+                        int type;
+                        xyz2zxy::get_volume_size(source, sx, sy, sz, type);
+                        stats.sx = sx;
+                        stats.sy = sy;
+                        stats.sz = sz;
+                        stats.type = type;
+                        const size_t mem_limit = (opt.mem_limit > 0) ? opt.mem_limit : xyz2zxy::memory_budget();
+                        const uint32_t workers = xyz2zxy::worker_count(opt.threads);
+                        stats.threads = workers;
+                        const uint32_t planes = xyz2zxy::output_planes(opt.order, sx, sy, sz);
+                        sink.open(planes);
+                        mi::thread_pool pool(workers); // shared by all stages and the prefetcher
+                        const std::unique_ptr<mi::progress_tracker> tracker = xyz2zxy::open_progress(opt);
+                        auto begin_progress = [&tracker](const std::string &stage, const uint64_t total, const std::string &unit) {
+                                if (tracker) {
+                                        tracker->begin(stage, total, unit);
+                                }
+                        };
+                        // called by the workers. Only atomic counters are updated.
+                        auto progress = [&tracker](const uint64_t items, const uint64_t bytes) {
+                                if (tracker) {
+                                        tracker->add(items, bytes);
+                                }
+                        };
+                        auto end_progress = [&tracker]() {
+                                if (tracker) {
+                                        tracker->end();
+                                }
+                        };
+                        std::atomic<uint32_t> failed_plane{std::numeric_limits<uint32_t>::max()}; // the first plane not written
+                        auto write = [&sink, &stats, &failed_plane](const uint32_t u, const cv::Mat &image) {
+                                statistics::scoped_timer timer(stats.encode_ns);
+                                if (sink.write(u, image)) {
+                                        return true;
+                                }
+                                for (uint32_t v = failed_plane; u < v && !failed_plane.compare_exchange_weak(v, u);) {}
+                                return false;
+                        };
+                        // throws if a plane was not written, so that the scratch is left for --resume.
+                        auto close = [&sink, &stats, &opt, &failed_plane]() {
+                                sink.close();
+                                stats.output_bytes = sink.bytes_written();
+                                stats.output_files = sink.files_created();
+                                if (const uint32_t u = failed_plane; u != std::numeric_limits<uint32_t>::max()) {
+                                        throw std::runtime_error(opt.output.string() + " : the plane " + std::to_string(u) + " cannot be written.");
+                                }
+                        };
+                        // a plane given up by an exception releases the writers waiting for it.
+                        auto guarded = [&sink](auto fn) {
+                                return [&sink, fn](const size_t i) {
+                                        try {
+                                                fn(i);
+                                        } catch (...) {
+                                                sink.cancel();
+                                                throw;
+                                        }
+                                };
+                        };
+                        const auto begin = statistics::clock::now();
+
+                        if constexpr (Slice == 'z') {
+                                const uint32_t step = (opt.step > 0) ? uint32_t(opt.step) : uint32_t(xyz2zxy::chunk_size(sx, sy, sz, type, 0, mem_limit, uint32_t(opt.prefetch) + 1, workers));
+                                stats.mode = "streaming";
+                                stats.step = step;
+                                xyz2zxy::chunk_prefetcher prefetcher(source, xyz2zxy::chunk_ranges(sz, step), cv::Size(int(sx), int(sy)), type, uint32_t(opt.prefetch), pool, &stats, xyz2zxy::cache_policy(opt.cache));
+                                begin_progress("Reslice", planes, "planes");
+                                for (uint32_t z = 0; z < sz; z += step) {
+                                        std::vector<cv::Mat> images = prefetcher.next();
+                                        pool.parallel_for(images.size(), guarded([&](const size_t i) {
+                                                if constexpr (Transposed) {
+                                                        cv::Mat result;
+                                                        {
+                                                                statistics::scoped_timer timer(stats.transpose_ns);
+                                                                xyz2zxy::transpose(images[i], result);
+                                                        }
+                                                        write(z + uint32_t(i), result);
+                                                } else {
+                                                        write(z + uint32_t(i), images[i]);
+                                                }
+                                                progress(1, images[i].total() * images[i].elemSize());
+                                        }));
+                                }
+                                end_progress();
+                                close();
+                                stats.add_stage("Reslice", begin);
+                        } else {
+                                constexpr bool is_horizontal = (Slice == 'x');
+                                const uint32_t width = is_horizontal ? sy : sx; // width of a strip
+                                if (xyz2zxy::fits_in_memory(sx, sy, sz, type, mem_limit, workers)) {
+                                        // all slices are kept in memory, so that the temporary files are not required.
+                                        stats.mode = "in-memory";
+                                        stats.step = sz;
+                                        std::vector<cv::Mat> images = xyz2zxy::read_images(source, 0, sz, pool, &stats, cv::Rect(), cv::Size(int(sx), int(sy)), type);
+                                        stats.add_stage("Read", begin);
+                                        const auto begin_memory = statistics::clock::now();
+                                        begin_progress("In-memory", planes, "planes");
+                                        pool.parallel_for(planes, guarded([&](const size_t u) {
+                                                cv::Mat result;
+                                                {
+                                                        statistics::scoped_timer timer(stats.transpose_ns);
+                                                        if constexpr (is_horizontal && Transposed) {
+                                                                xyz2zxy::gather_columns(images, int(u), result);
+                                                        } else if constexpr (is_horizontal) {
+                                                                xyz2zxy::stack_columns(images, int(u), result);
+                                                        } else if constexpr (Transposed) {
+                                                                xyz2zxy::gather_rows(images, int(u), result);
+                                                        } else {
+                                                                xyz2zxy::stack_rows(images, int(u), result);
+                                                        }
+                                                }
+                                                write(uint32_t(u), result);
+                                                progress(1, result.total() * result.elemSize());
+                                        }));
+                                        end_progress();
+                                        close();
+                                        stats.add_stage("In-memory", begin_memory);
+                                        return;
+                                }
+
+                                const std::filesystem::path tmpDir = opt.tmp_dir.empty() ? std::filesystem::path(opt.output.string() + "_temp") : opt.tmp_dir;
+                                // row strips are cut from row bands when the source decodes only the rows requested, so that a chunk can be deep regardless of the slice size.
+                                // bands of 64 rows or more keep the decoding of compressed strips efficient.
+                                const bool is_banded = !is_horizontal && source.is_partial();
+                                const uint32_t min_rows = is_banded ? std::min(sy, 64u) : sy;
+                                uint32_t step = (opt.step > 0) ? uint32_t(opt.step) : uint32_t(xyz2zxy::chunk_size(sx, min_rows, sz, type, width, mem_limit, uint32_t(opt.prefetch) + 1, workers));
+                                xyz2zxy::strip_manifest manifest{opt.order, opt.scratch, type, sx, sy, sz, step};
+                                const bool is_resumed = opt.is_resumed && std::filesystem::exists(tmpDir / "manifest.txt");
+                                if (is_resumed) {
+                                        xyz2zxy::strip_manifest previous;
+                                        previous.load(tmpDir / "manifest.txt");
+                                        if (!previous.is_same_volume(manifest)) {
+                                                throw std::runtime_error(tmpDir.string() + " cannot be resumed. The volume or the options are different.");
+                                        }
+                                        manifest.step = step = previous.step; // strips of the previous run are reused
+                                } else {
+                                        xyz2zxy::create_directory(tmpDir);
+                                        manifest.save(tmpDir / "manifest.txt");
+                                }
+                                const uint32_t num_threads = xyz2zxy::concurrency(sz, type, width, mem_limit, workers);
+                                stats.mode = "out-of-core";
+                                stats.step = step;
+                                stats.threads = num_threads;
+                                stats.scratch_files = (is_resumed ? 0 : 1) + (std::filesystem::exists(tmpDir / "checkpoint.txt") ? 0 : 1); // manifest.txt and checkpoint.txt
+                                xyz2zxy::checkpoint ck(tmpDir / "checkpoint.txt", is_resumed);
+                                std::unique_ptr<xyz2zxy::scratch> storage = xyz2zxy::open_scratch(tmpDir, manifest, true, xyz2zxy::cache_policy(opt.cache));
+                                stats.io = storage->io();
+                                const uint32_t rows = is_banded ? xyz2zxy::band_rows(sx, sy, type, step, mem_limit, uint32_t(opt.prefetch) + 1, workers) : sy;
+                                stats.band_rows = rows;
+                                std::vector<xyz2zxy::chunk_range> ranges;
+                                uint32_t slices = 0; // slices not divided yet
+                                for (const auto &c: xyz2zxy::chunk_ranges(sz, step)) {
+                                        if (ck.has_chunk(c.begin)) {
+                                                continue;
+                                        }
+                                        slices += c.end - c.begin;
+                                        for (uint32_t y = 0; y < sy; y += rows) {
+                                                ranges.push_back(xyz2zxy::chunk_range{c.begin, c.end, is_banded ? cv::Rect(0, int(y), int(sx), int(std::min(rows, sy - y))) : cv::Rect()});
+                                        }
+                                }
+                                stats.resumed_chunks = ck.chunks();
+                                if (is_resumed && opt.is_verbose) {
+                                        std::cerr << "Resume " << tmpDir.string() << " (" << ck.chunks() << " chunks, " << ck.planes() << " planes finished)" << std::endl;
+                                }
+                                begin_progress("Step1 divide", slices, "slices");
+                                xyz2zxy::chunk_prefetcher prefetcher(source, ranges, cv::Size(int(sx), int(sy)), type, uint32_t(opt.prefetch), pool, &stats, xyz2zxy::cache_policy(opt.cache));
+                                for (const auto &c: ranges) {
+                                        std::vector<cv::Mat> images = prefetcher.next(); // decoded in parallel while the previous chunk is written
+                                        const uint32_t z = c.begin;
+                                        const uint32_t y0 = uint32_t(c.rect.y); // the first row of the band
+                                        const uint32_t num_strips = is_banded ? uint32_t(c.rect.height) : planes;
+                                        size_t band_bytes = 0;
+                                        for (const auto &image: images) {
+                                                band_bytes += image.total() * image.elemSize();
+                                        }
+                                        pool.parallel_for(num_strips, [&images, &sx, &sy, &z, &y0, &storage, &stats](const size_t i) {
+                                                const uint32_t u = y0 + uint32_t(i);
+                                                cv::Mat local;
+                                                {
+                                                        statistics::scoped_timer timer(stats.transpose_ns);
+                                                        std::vector<cv::Mat> local_images;
+                                                        const cv::Rect rect = is_horizontal ? cv::Rect(int(u), 0, 1, int(sy)) : cv::Rect(0, int(i), int(sx), 1);
+                                                        std::transform(images.begin(), images.end(), std::back_inserter(local_images), [&rect](auto &image) { return cv::Mat(image, rect); }); // cut
+                                                        if constexpr (is_horizontal) {
+                                                                cv::hconcat(local_images, local);
+                                                        } else {
+                                                                cv::vconcat(local_images, local);
+                                                        }
+                                                }
+                                                statistics::scoped_timer timer(stats.scratch_write_ns);
+                                                storage->write(u, z, local);
+                                                stats.scratch_written_bytes += local.total() * local.elemSize();
+                                        });
+                                        if (!is_banded || y0 + num_strips == sy) { // the last band of the chunk
+                                                {
+                                                        statistics::scoped_timer timer(stats.scratch_write_ns);
+                                                        storage->flush(); // the strips are stored before the journal line
+                                                }
+                                                ck.add_chunk(z);
+                                                progress(c.end - c.begin, band_bytes);
+                                        } else {
+                                                progress(0, band_bytes);
+                                        }
+                                }
+                                end_progress();
+                                stats.scratch_files += storage->files_created();
+                                storage.reset();
+                                stats.add_stage("Step1", begin);
+                                manifest.load(tmpDir / "manifest.txt");
+                                std::filesystem::path scratchDir = tmpDir;
+                                if (const uint32_t merged_step = ck.merged_step(); merged_step > 0) { // the merge levels finished in the previous run
+                                        manifest.step = merged_step;
+                                        scratchDir = tmpDir / ("merge-" + std::to_string(merged_step));
+                                }
+                                if (manifest.scratch == "files" && opt.merge > 0) {
+                                        // strips of consecutive chunks are merged level by level, so that Step2 reads a few large strips of a plane instead of many small ones.
+                                        // each level reads the directories of a group in the order the strips were written, i.e., mostly sequentially.
+                                        const auto begin_merge = statistics::clock::now();
+                                        const size_t budget = mem_limit / num_threads;
+                                        const size_t strip_bytes = size_t(width) * manifest.step * CV_ELEM_SIZE(type);
+                                        const std::vector<uint32_t> fans = xyz2zxy::merge_levels((sz + manifest.step - 1) / manifest.step, uint32_t(opt.merge), strip_bytes, budget);
+                                        for (size_t l = 0; l < fans.size(); ++l) {
+                                                xyz2zxy::strip_manifest merged = manifest;
+                                                merged.step = uint32_t(std::min<uint64_t>(uint64_t(manifest.step) * fans[l], sz));
+                                                const std::filesystem::path mergedDir = tmpDir / ("merge-" + std::to_string(merged.step));
+                                                const uint32_t groups = (sz + merged.step - 1) / merged.step;
+                                                const size_t merged_bytes = size_t(width) * merged.step * CV_ELEM_SIZE(type);
+                                                const uint32_t band = uint32_t(std::clamp<size_t>(budget / merged_bytes, 1, planes)); // planes merged by a worker at once
+                                                const uint32_t bands = (planes + band - 1) / band;
+                                                {
+                                                        xyz2zxy::files_scratch src(scratchDir, manifest, xyz2zxy::cache_policy(opt.cache));
+                                                        xyz2zxy::files_scratch dst(mergedDir, merged, xyz2zxy::cache_policy(opt.cache));
+                                                        begin_progress("Merge " + std::to_string(l + 1) + "/" + std::to_string(fans.size()), uint64_t(groups) * bands, "bands");
+                                                        pool.parallel_for(size_t(groups) * bands, [&](const size_t i) {
+                                                                const uint32_t u0 = uint32_t(i % bands) * band;
+                                                                size_t bytes;
+                                                                {
+                                                                        statistics::scoped_timer timer(stats.scratch_read_ns);
+                                                                        bytes = src.merge(dst, uint32_t(i / bands) * merged.step, u0, std::min(u0 + band, planes));
+                                                                }
+                                                                stats.scratch_read_bytes += bytes;
+                                                                stats.scratch_written_bytes += bytes;
+                                                                progress(1, bytes);
+                                                        }, num_threads);
+                                                        {
+                                                                statistics::scoped_timer timer(stats.scratch_write_ns);
+                                                                dst.flush();
+                                                        }
+                                                        ck.add_merge(merged.step); // the strips of the previous level are not used any more
+                                                        src.remove();
+                                                        stats.scratch_files += dst.files_created();
+                                                }
+                                                end_progress();
+                                                if (scratchDir != tmpDir) {
+                                                        std::filesystem::remove_all(scratchDir);
+                                                }
+                                                manifest = merged;
+                                                scratchDir = mergedDir;
+                                        }
+                                        stats.merge_levels = uint32_t(fans.size());
+                                        if (!fans.empty()) {
+                                                stats.add_stage("Merge", begin_merge);
+                                        }
+                                }
+                                const auto begin_step2 = statistics::clock::now();
+                                storage = xyz2zxy::open_scratch(scratchDir, manifest, false, xyz2zxy::cache_policy(opt.cache));
+                                begin_progress("Step2 concat", planes, "planes");
+                                pool.parallel_for(planes, guarded([&](const size_t u) {
+                                        if (is_resumed && ck.has_plane(uint32_t(u), sink.size_of(uint32_t(u)))) {
+                                                ++stats.resumed_planes;
+                                                progress(1, 0);
+                                                return;
+                                        }
+                                        cv::Mat plane;
+                                        {
+                                                statistics::scoped_timer timer(stats.scratch_read_ns);
+                                                plane = storage->read(uint32_t(u));
+                                        }
+                                        const size_t plane_bytes = plane.total() * plane.elemSize();
+                                        stats.scratch_read_bytes += plane_bytes;
+                                        bool is_written;
+                                        if constexpr (Transposed) {
+                                                cv::Mat result;
+                                                {
+                                                        statistics::scoped_timer timer(stats.transpose_ns);
+                                                        xyz2zxy::transpose(plane, result); // mirroring and rotation
+                                                }
+                                                is_written = write(uint32_t(u), result);
+                                        } else {
+                                                is_written = write(uint32_t(u), plane);
+                                        }
+                                        plane.release(); // it may refer the scratch
+                                        storage->release(uint32_t(u));
+                                        if (const uint64_t bytes = sink.size_of(uint32_t(u)); is_written && bytes > 0) {
+                                                ck.add_plane(uint32_t(u), bytes);
+                                        }
+                                        progress(1, plane_bytes);
+                                }), num_threads);
+                                end_progress();
+                                close();
+                                storage.reset();
+                                std::filesystem::remove_all(tmpDir);
+                                stats.add_stage("Step2", begin_step2);
+                        }
+                }
+
+                /**
+                 * @brief Reslice the volume into the 3D blocks of the sink.
+                 * @note Blocks are cut from slabs of block_size() slices (row bands of the slabs if the source reads the rows partially),
+                 * so that neither the temporary data nor Step2 is required.
+                 */
+                inline void reslice_blocks(const slice_source &source, slice_sink &sink, const options &opt, statistics &stats) {
+                        uint32_t sx, sy, sz;
+                        int type;
+                        xyz2zxy::get_volume_size(source, sx, sy, sz, type);
+                        stats.sx = sx;
+                        stats.sy = sy;
+                        stats.sz = sz;
+                        stats.type = type;
+                        const size_t mem_limit = (opt.mem_limit > 0) ? opt.mem_limit : xyz2zxy::memory_budget();
+                        const uint32_t workers = xyz2zxy::worker_count(opt.threads);
+                        const uint32_t b = sink.block_size();
+                        const size_t pixel = CV_ELEM_SIZE(type);
+                        const uint32_t size[3] = {sx, sy, sz};
+                        const int axis[3] = {opt.order[0] - 'x', opt.order[1] - 'x', opt.order[2] - 'x'}; // axes of the columns, rows and planes
+                        sink.open_blocks(size[axis[0]], size[axis[1]], size[axis[2]], type);
+                        mi::thread_pool pool(workers);
+                        const uint32_t rows = source.is_partial() ? std::max(xyz2zxy::band_rows(sx, sy, type, b, mem_limit, uint32_t(opt.prefetch) + 1, workers) / b, 1u) * b : sy;
+                        stats.mode = "blocks";
+                        stats.step = b;
+                        stats.threads = workers;
+                        stats.band_rows = std::min(rows, sy);
+                        std::vector<xyz2zxy::chunk_range> ranges;
+                        for (const auto &c: xyz2zxy::chunk_ranges(sz, b)) {
+                                for (uint32_t y = 0; y < sy; y += rows) {
+                                        ranges.push_back(xyz2zxy::chunk_range{c.begin, c.end, rows < sy ? cv::Rect(0, int(y), int(sx), int(std::min(rows, sy - y))) : cv::Rect()});
+                                }
+                        }
+                        const std::unique_ptr<mi::progress_tracker> tracker = xyz2zxy::open_progress(opt);
+                        const auto begin = statistics::clock::now();
+                        std::atomic<bool> is_failed{false};
+                        const uint32_t nx = (sx + b - 1) / b;
+                        if (tracker) {
+                                tracker->begin("Blocks", ranges.size(), "bands");
+                        }
+                        xyz2zxy::chunk_prefetcher prefetcher(source, ranges, cv::Size(int(sx), int(sy)), type, uint32_t(opt.prefetch), pool, &stats, xyz2zxy::cache_policy(opt.cache));
+                        for (const auto &c: ranges) {
+                                std::vector<cv::Mat> images = prefetcher.next();
+                                const uint32_t y0 = uint32_t(c.rect.y); // the first row of the band
+                                const uint32_t height = uint32_t(images.front().rows);
+                                pool.parallel_for(size_t(nx) * ((height + b - 1) / b), [&](const size_t n) {
+                                        const uint32_t origin[3] = {uint32_t(n % nx) * b, y0 + uint32_t(n / nx) * b, c.begin};
+                                        const uint32_t extent[3] = {std::min(b, sx - origin[0]), std::min(b, y0 + height - origin[1]), c.end - c.begin};
+                                        const std::array<uint32_t, 3> block_size = {extent[axis[0]], extent[axis[1]], extent[axis[2]]};
+                                        std::vector<uint8_t> data(size_t(block_size[0]) * block_size[1] * block_size[2] * pixel);
+                                        {
+                                                statistics::scoped_timer timer(stats.transpose_ns);
+                                                uint8_t *dst = data.data();
+                                                uint32_t p[3] = {0, 0, 0}; // the voxel in the block
+                                                for (uint32_t k = 0; k < block_size[2]; ++k) {
+                                                        p[axis[2]] = k;
+                                                        for (uint32_t j = 0; j < block_size[1]; ++j) {
+                                                                p[axis[1]] = j;
+                                                                if (axis[0] == 0) { // a row of the block is a part of a row of the slice
+                                                                        const uint8_t *src = images[p[2]].ptr(int(origin[1] - y0 + p[1])) + origin[0] * pixel;
+                                                                        std::memcpy(dst, src, block_size[0] * pixel);
+                                                                        dst += block_size[0] * pixel;
+                                                                        continue;
+                                                                }
+                                                                for (uint32_t i = 0; i < block_size[0]; ++i, dst += pixel) {
+                                                                        p[axis[0]] = i;
+                                                                        const uint8_t *src = images[p[2]].ptr(int(origin[1] - y0 + p[1])) + (origin[0] + p[0]) * pixel;
+                                                                        std::memcpy(dst, src, pixel);
+                                                                }
+                                                        }
+                                                }
+                                        }
+                                        statistics::scoped_timer timer(stats.encode_ns);
+                                        if (!sink.write_block(origin[axis[0]] / b, origin[axis[1]] / b, origin[axis[2]] / b, block_size, data)) {
+                                                is_failed = true;
+                                        }
+                                });
+                                if (tracker) {
+                                        size_t bytes = 0;
+                                        for (const auto &image: images) {
+                                                bytes += image.total() * image.elemSize();
+                                        }
+                                        tracker->add(1, bytes);
+                                }
+                        }
+                        if (tracker) {
+                                tracker->end();
+                        }
+                        sink.close();
+                        stats.output_bytes = sink.bytes_written();
+                        stats.output_files = sink.files_created();
+                        stats.add_stage("Blocks", begin);
+                        if (is_failed) {
+                                throw std::runtime_error(opt.output.string() + " : some blocks cannot be written.");
+                        }
+                }
+        }
+
+        /**
+         * @brief Reslice the volume into the axis order opt.order.
+         * @param stats Counters of the run.
+         * @throw runtime_error if the order is invalid or the conversion fails.
+         */
+        inline void reslice(const slice_source &source, slice_sink &sink, const options &opt, statistics &stats) {
+                if (!xyz2zxy::is_valid_order(opt.order)) {
+                        throw std::runtime_error("Invalid order : " + opt.order);
+                }
+                if (!opt.roi.is_empty()) {
+                        options sub = opt;
+                        sub.roi = region();
+                        xyz2zxy::reslice(xyz2zxy::roi_source(source, opt.roi), sink, sub, stats);
+                        return;
+                }
+                if (sink.block_size() > 0) {
+                        xyz2zxy::detail::reslice_blocks(source, sink, opt, stats);
+                        return;
+                }
+                // each permutation has its own access pattern.
+                if (opt.order == "zxy") {
+                        xyz2zxy::detail::reslice<'y', true>(source, sink, opt, stats);
+                } else if (opt.order == "xzy") {
+                        xyz2zxy::detail::reslice<'y', false>(source, sink, opt, stats);
+                } else if (opt.order == "yzx") {
+                        xyz2zxy::detail::reslice<'x', true>(source, sink, opt, stats);
+                } else if (opt.order == "zyx") {
+                        xyz2zxy::detail::reslice<'x', false>(source, sink, opt, stats);
+                } else if (opt.order == "yxz") {
+                        xyz2zxy::detail::reslice<'z', true>(source, sink, opt, stats);
+                } else {
+                        xyz2zxy::detail::reslice<'z', false>(source, sink, opt, stats);
+                }
+        }
+
+        inline void reslice(const slice_source &source, slice_sink &sink, const options &opt) {
+                statistics stats;
+                xyz2zxy::reslice(source, sink, opt, stats);
+        }
+
+        /**
+         * @brief Reslicer for embedding the conversion into other programs.
+         * @code
+         * xyz2zxy::options opt;
+         * opt.order = "yzx";
+         * xyz2zxy::Reslicer(opt).setInput(images).setOutput([](uint32_t u, const cv::Mat &plane) { return true; }).run();
+         * @endcode
+         */
+        class Reslicer {
+        private:
+                options options_;
+                std::unique_ptr<slice_source> source_;
+                std::unique_ptr<slice_sink> sink_;
+                std::unique_ptr<statistics> stats_;
+        public:
+                explicit Reslicer(options opt = options()) : options_(std::move(opt)), stats_(std::make_unique<statistics>()) {}
+
+                [[nodiscard]] options &getOptions() {
+                        return this->options_;
+                }
+
+                /// counters of the last run.
+                [[nodiscard]] const statistics &getStatistics() const {
+                        return *this->stats_;
+                }
+
+                /// a directory of images, a multi-page TIFF or a NRRD volume.
+                Reslicer &setInput(const std::filesystem::path &path) {
+                        this->options_.input = path;
+                        this->source_ = xyz2zxy::open_source(path);
+                        return *this;
+                }
+
+                /// slices on the memory (shared, not copied).
+                Reslicer &setInput(std::vector<cv::Mat> images) {
+                        return this->setInput(std::make_unique<mat_source>(std::move(images)));
+                }
+
+                Reslicer &setInput(std::unique_ptr<slice_source> source) {
+                        this->source_ = std::move(source);
+                        return *this;
+                }
+
+                /// a directory (image files), a .tif/.tiff/.btf file (a BigTIFF) or a .zarr directory (3D blocks). The levels of options::pyramid are written beside it.
+                Reslicer &setOutput(const std::filesystem::path &path) {
+                        this->options_.output = path;
+                        this->sink_ = xyz2zxy::open_sink(path, this->options_);
+                        return *this;
+                }
+
+                /// a function receiving each plane. It is called from multiple threads in any order.
+                Reslicer &setOutput(callback_sink::callback fn) {
+                        return this->setOutput(std::make_unique<callback_sink>(std::move(fn)));
+                }
+
+                Reslicer &setOutput(std::unique_ptr<slice_sink> sink) {
+                        this->sink_ = std::move(sink);
+                        return *this;
+                }
+
+                /**
+                 * @brief Run the conversion. The report is saved if options::report is set.
+                 * @throw runtime_error if the input or the output is not set, or the conversion fails.
+                 */
+                void run() {
+                        if (!this->source_ || !this->sink_) {
+                                throw std::runtime_error("Input or output is not set.");
+                        }
+                        if (this->source_->size() == 0) {
+                                throw std::runtime_error("Empty images");
+                        }
+                        this->stats_ = std::make_unique<statistics>();
+                        xyz2zxy::reslice(*this->source_, *this->sink_, this->options_, *this->stats_);
+                        if (!this->options_.report.empty()) {
+                                this->stats_->save(this->options_.report, this->options_);
+                        }
+                }
+        };
+
         void print_peak_memory_size() {
                 std::cout << "peak_memory_size[KB]: " << mi::peak_memory_size() / 1024.0 << std::endl;
         }